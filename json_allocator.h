@@ -0,0 +1,120 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_ALLOCATOR_H)
+#define ADHD_JSON_ALLOCATOR_H
+
+#include <boost/container/allocator_traits.hpp>
+#include <boost/container/string.hpp>
+#include <boost/container/vector.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <new>
+
+namespace adhd
+{
+   namespace detail
+   {
+      /// Containers used by basic_json_value for a given allocator. The
+      /// default allocator uses the standard containers, any other
+      /// allocator, such as a polymorphic allocator, uses Boost.Container
+      /// which supports stateful allocators also before C++11.
+      template <typename TAllocator>
+      struct json_allocator_traits
+      {
+         template <typename T>
+         struct rebind
+         {
+            typedef typename boost::container::allocator_traits<TAllocator>::template portable_rebind_alloc<T>::type type;
+         };
+
+         typedef boost::container::basic_string<char, std::char_traits<char>, typename rebind<char>::type> string_type;
+
+         template <typename T>
+         struct vector
+         {
+            typedef boost::container::vector<T, typename rebind<T>::type> type;
+         };
+      };
+
+      template <>
+      struct json_allocator_traits< std::allocator<char> >
+      {
+         template <typename T>
+         struct rebind
+         {
+            typedef std::allocator<T> type;
+         };
+
+         typedef std::string string_type;
+
+         template <typename T>
+         struct vector
+         {
+            typedef std::vector<T> type;
+         };
+      };
+
+      /// Allocates a TNode with a copy of alloc, constructed as TNode(alloc).
+      template <typename TNode, typename TAllocator>
+      TNode* json_new_node(const TAllocator& alloc)
+      {
+         typename json_allocator_traits<TAllocator>::template rebind<TNode>::type a(alloc);
+         TNode* p = &*a.allocate(1);
+         try
+         {
+            new (p) TNode(alloc);
+         }
+         catch (...)
+         {
+            a.deallocate(p, 1);
+            throw;
+         }
+
+         return p;
+      }
+
+      /// Allocates a TNode with a copy of alloc, constructed as TNode(arg, alloc).
+      template <typename TNode, typename TAllocator, typename TArg>
+      TNode* json_new_node(const TAllocator& alloc, const TArg& arg)
+      {
+         typename json_allocator_traits<TAllocator>::template rebind<TNode>::type a(alloc);
+         TNode* p = &*a.allocate(1);
+         try
+         {
+            new (p) TNode(arg, alloc);
+         }
+         catch (...)
+         {
+            a.deallocate(p, 1);
+            throw;
+         }
+
+         return p;
+      }
+
+      /// Destroys and deallocates a node created by json_new_node, using
+      /// the allocator stored in the node.
+      template <typename TNode>
+      void json_delete_node(TNode* p)
+      {
+         typename json_allocator_traits<typename TNode::allocator_type>::template rebind<TNode>::type a(p->alloc);
+         p->~TNode();
+         a.deallocate(p, 1);
+      }
+
+      /// Replaces the contents of dst with a copy of src, keeping the allocator of dst.
+      template <typename T>
+      void json_assign(T& dst, const T& src)
+      {
+         dst.assign(src.begin(), src.end());
+      }
+   }
+}
+
+#endif
@@ -0,0 +1,195 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "json_document.h"
+#include <boost/cstdint.hpp>
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#endif
+
+namespace adhd
+{
+   namespace
+   {
+      const size_t huge_page_size = 2 * 1024 * 1024;
+      const size_t max_chunk_size = 32 * 1024 * 1024;
+
+      size_t round_up(size_t n, size_t multiple)
+      {
+         return (n + multiple - 1) / multiple * multiple;
+      }
+
+      /// Maps size bytes of pages, a multiple of huge_page_size, aligned to
+      /// huge_page_size and preferably backed by huge pages. Returns null
+      /// on failure.
+      void* map_pages(size_t size)
+      {
+#if defined(_WIN32)
+         const SIZE_T large_page_size = GetLargePageMinimum();
+         if (large_page_size != 0 && size % large_page_size == 0)
+         {
+            void* p = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (p)
+               return p;
+         }
+
+         return VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+         // Huge pages only back whole, aligned huge pages, so a huge page
+         // more is mapped and the ends beyond the aligned size are unmapped.
+         const size_t mapped_size = size + huge_page_size;
+         void* p = mmap(0, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+         if (p == MAP_FAILED)
+            return 0;
+
+         char* first = static_cast<char*>(p);
+         char* aligned = first + (huge_page_size - reinterpret_cast<boost::uintptr_t>(first) % huge_page_size) % huge_page_size;
+         if (aligned != first)
+            munmap(first, aligned - first);
+         if (aligned + size != first + mapped_size)
+            munmap(aligned + size, first + mapped_size - (aligned + size));
+
+#  if defined(MADV_HUGEPAGE)
+         madvise(aligned, size, MADV_HUGEPAGE);
+#  endif
+         return aligned;
+#endif
+      }
+
+      void unmap_pages(void* p, size_t size)
+      {
+#if defined(_WIN32)
+         (void)size;
+         VirtualFree(p, 0, MEM_RELEASE);
+#else
+         munmap(p, size);
+#endif
+      }
+   }
+
+   /// Header at the start of every chunk.
+   struct json_arena::chunk
+   {
+      chunk* next;
+      size_t size;
+      bool mapped;
+   };
+
+   json_arena::json_arena(size_t chunk_size, bool huge_pages)
+      : head(0)
+      , current(0)
+      , end(0)
+      , chunk_size(std::max<size_t>(chunk_size, 256))
+      , next_chunk_size(this->chunk_size)
+      , allocated_size(0)
+      , reserved_size(0)
+      , huge_pages(huge_pages)
+   {
+   }
+
+   json_arena::~json_arena()
+   {
+      release();
+   }
+
+   void json_arena::release()
+   {
+      while (head)
+      {
+         chunk* c = head;
+         head = c->next;
+         if (c->mapped)
+            unmap_pages(c, c->size);
+         else
+            free(c);
+      }
+
+      current = 0;
+      end = 0;
+      next_chunk_size = chunk_size;
+      allocated_size = 0;
+      reserved_size = 0;
+   }
+
+   void* json_arena::do_allocate(size_t bytes, size_t alignment)
+   {
+      size_t padding = (alignment - reinterpret_cast<boost::uintptr_t>(current) % alignment) % alignment;
+      if (static_cast<size_t>(end - current) < padding + bytes)
+      {
+         add_chunk(bytes + alignment);
+         padding = (alignment - reinterpret_cast<boost::uintptr_t>(current) % alignment) % alignment;
+      }
+
+      char* p = current + padding;
+      current = p + bytes;
+      allocated_size += bytes;
+      return p;
+   }
+
+   void json_arena::do_deallocate(void* /*p*/, size_t /*bytes*/, size_t /*alignment*/)
+   {
+   }
+
+   bool json_arena::do_is_equal(const boost::container::pmr::memory_resource& other) const BOOST_NOEXCEPT
+   {
+      return this == &other;
+   }
+
+   void json_arena::add_chunk(size_t min_size)
+   {
+      // Keeps the memory after the header maximally aligned.
+      const size_t chunk_header_size = round_up(sizeof(chunk), 16);
+
+      size_t size = std::max(next_chunk_size, min_size + chunk_header_size);
+      next_chunk_size = std::min(next_chunk_size * 2, std::max(max_chunk_size, chunk_size));
+
+      chunk* c = 0;
+      bool mapped = false;
+      if (huge_pages)
+      {
+         size = round_up(size, huge_page_size);
+         c = static_cast<chunk*>(map_pages(size));
+         mapped = c != 0;
+      }
+
+      if (!c)
+      {
+         c = static_cast<chunk*>(malloc(size));
+         if (!c)
+            throw std::bad_alloc();
+      }
+
+      c->next = head;
+      c->size = size;
+      c->mapped = mapped;
+      head = c;
+      current = reinterpret_cast<char*>(c) + chunk_header_size;
+      end = reinterpret_cast<char*>(c) + size;
+      reserved_size += size;
+   }
+
+   json_document::json_document(size_t chunk_size, bool huge_pages)
+      : arena(chunk_size, huge_pages)
+   {
+      new (&storage) value_type();
+   }
+
+   json_document::~json_document()
+   {
+   }
+
+   void json_document::clear()
+   {
+      new (&storage) value_type();
+      arena.release();
+   }
+}
@@ -0,0 +1,143 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_DOCUMENT_H)
+#define ADHD_JSON_DOCUMENT_H
+
+#include "json_parser.h"
+#include <boost/container/pmr/memory_resource.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <string>
+
+namespace adhd
+{
+   /// Memory resource handing out memory from large chunks by bumping a
+   /// pointer. Deallocation does nothing, the chunks are freed all at once
+   /// by release() or the destructor. Chunks start at chunk_size bytes and
+   /// double in size as the arena grows. With huge_pages the chunks are
+   /// mapped directly from the operating system, rounded up to whole huge
+   /// pages, and the system is asked to back them with huge pages where
+   /// supported. Not thread safe.
+   class ADHD_JSON_API json_arena : public boost::container::pmr::memory_resource
+   {
+   public:
+      enum
+      {
+         default_chunk_size = 64 * 1024,
+      };
+
+      explicit json_arena(size_t chunk_size = default_chunk_size, bool huge_pages = false);
+
+      virtual ~json_arena();
+
+      /// Frees every chunk.
+      void release();
+
+      /// Number of bytes handed out since construction or the last release().
+      size_t get_allocated_size() const
+      {
+         return allocated_size;
+      }
+
+      /// Number of bytes held in chunks.
+      size_t get_reserved_size() const
+      {
+         return reserved_size;
+      }
+
+   protected:
+      virtual void* do_allocate(size_t bytes, size_t alignment);
+
+      virtual void do_deallocate(void* p, size_t bytes, size_t alignment);
+
+      virtual bool do_is_equal(const boost::container::pmr::memory_resource& other) const BOOST_NOEXCEPT;
+
+   private:
+      struct chunk;
+
+      json_arena(const json_arena&);
+      json_arena& operator=(const json_arena&);
+
+      void add_chunk(size_t min_size);
+
+      chunk* head;
+      char* current;
+      char* end;
+      size_t chunk_size;
+      size_t next_chunk_size;
+      size_t allocated_size;
+      size_t reserved_size;
+      bool huge_pages;
+   };
+
+   /// A JSON document whose strings, arrays and objects are all allocated
+   /// from an arena owned by the document. Destroying or clearing the
+   /// document frees the arena chunks without visiting the values, so
+   /// tearing down a large document costs a handful of frees.
+   ///
+   /// Values stored in the document must be allocated from it, construct
+   /// them with get_allocator(). Values allocated elsewhere and stored in
+   /// the document are never released. Copies of values in the document
+   /// share their memory, so they must not outlive the document or be used
+   /// after clear().
+   class ADHD_JSON_API json_document
+   {
+   public:
+      typedef pmr::json_value value_type;
+      typedef value_type::allocator_type allocator_type;
+
+      explicit json_document(size_t chunk_size = json_arena::default_chunk_size, bool huge_pages = false);
+
+      ~json_document();
+
+      /// Parses a JSON text into the root, replacing the previous root.
+      void parse(const std::string& str)
+      {
+         parse(str.c_str());
+      }
+
+      template <typename TIterator>
+      void parse(TIterator iter)
+      {
+         json_parser().parse(iter, root(), get_allocator());
+      }
+
+      value_type& root()
+      {
+         return *static_cast<value_type*>(static_cast<void*>(&storage));
+      }
+
+      const value_type& root() const
+      {
+         return *static_cast<const value_type*>(static_cast<const void*>(&storage));
+      }
+
+      allocator_type get_allocator()
+      {
+         return allocator_type(&arena);
+      }
+
+      /// Resets the root to null and frees the arena.
+      void clear();
+
+      const json_arena& get_arena() const
+      {
+         return arena;
+      }
+
+   private:
+      json_document(const json_document&);
+      json_document& operator=(const json_document&);
+
+      json_arena arena;
+
+      /// The root is never destroyed, its memory is reclaimed with the arena.
+      boost::aligned_storage<sizeof(value_type), boost::alignment_of<value_type>::value>::type storage;
+   };
+}
+
+#endif
@@ -0,0 +1,1168 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_OBJECT_STORAGE_H)
+#define ADHD_JSON_OBJECT_STORAGE_H
+
+#include "json_allocator.h"
+
+#include <boost/container/map.hpp>
+#include <boost/atomic.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <boost/type_traits/is_convertible.hpp>
+#include <boost/cstdint.hpp>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace adhd
+{
+   namespace detail
+   {
+      /// FNV-1a hash of a member name.
+      inline boost::uint32_t json_hash_name(boost::string_ref name)
+      {
+         boost::uint32_t hash = 2166136261u;
+         for (boost::string_ref::const_iterator i = name.begin(), e = name.end(); i != e; ++i)
+         {
+            hash ^= static_cast<unsigned char>(*i);
+            hash *= 16777619u;
+         }
+
+         return hash;
+      }
+   }
+
+   /// Name of an object member with its hash computed in advance, for
+   /// names looked up over and over, typically held in a static. Lookups
+   /// through hash indexes then skip hashing the name.
+   ///
+   /// The key also remembers the position the member was last found at,
+   /// an inline cache for object storage keeping members of objects with
+   /// the same names at the same positions, see json_shaped_objects. The
+   /// hint is only a guess, checked against the name before use, so keys
+   /// may be shared between threads.
+   class json_key
+   {
+   public:
+      explicit json_key(boost::string_ref name)
+         : name(name.data(), name.size())
+         , hash(detail::json_hash_name(name))
+         , hint(0)
+      {
+      }
+
+      json_key(const json_key& rhs)
+         : name(rhs.name)
+         , hash(rhs.hash)
+         , hint(rhs.get_hint())
+      {
+      }
+
+      json_key& operator=(const json_key& rhs)
+      {
+         name = rhs.name;
+         hash = rhs.hash;
+         set_hint(rhs.get_hint());
+         return *this;
+      }
+
+      boost::string_ref get_name() const
+      {
+         return boost::string_ref(name.data(), name.size());
+      }
+
+      boost::uint32_t get_hash() const
+      {
+         return hash;
+      }
+
+      /// Position the member was last found at.
+      size_t get_hint() const
+      {
+         return hint.load(boost::memory_order_relaxed);
+      }
+
+      void set_hint(size_t position) const
+      {
+         hint.store(static_cast<boost::uint32_t>(position), boost::memory_order_relaxed);
+      }
+
+   private:
+      std::string name;
+      boost::uint32_t hash;
+      mutable boost::atomic<boost::uint32_t> hint;
+   };
+
+   /// Member names looked up together, kept sorted by name so that objects
+   /// ordered by name resolve all of them in one merge pass. Keys are
+   /// numbered in the order they were added.
+   class json_key_set
+   {
+   public:
+      json_key_set()
+      {
+      }
+
+      /// Adds the names in [first, last), each convertible to boost::string_ref.
+      template <typename TIterator>
+      json_key_set(TIterator first, TIterator last)
+      {
+         for (; first != last; ++first)
+         {
+            add(*first);
+         }
+      }
+
+      /// Adds a key, returning its number.
+      size_t add(boost::string_ref name)
+      {
+         keys.push_back(json_key(name));
+         order.push_back(0);
+         size_t rank = order.size() - 1;
+         for (; rank != 0 && name < keys[order[rank - 1]].get_name(); --rank)
+         {
+            order[rank] = order[rank - 1];
+         }
+
+         order[rank] = keys.size() - 1;
+         return keys.size() - 1;
+      }
+
+      size_t size() const
+      {
+         return keys.size();
+      }
+
+      const json_key& get_key(size_t i) const
+      {
+         return keys[i];
+      }
+
+      /// Returns the number of the key at the given rank in name order.
+      size_t get_position(size_t rank) const
+      {
+         return order[rank];
+      }
+
+   private:
+      std::vector<json_key> keys;
+      std::vector<size_t> order;
+   };
+
+   namespace detail
+   {
+      /// Member of an object, referring to its name and value.
+      template <typename TValue>
+      struct json_member_ref
+      {
+         json_member_ref(boost::string_ref first, TValue& second)
+            : first(first)
+            , second(second)
+         {
+         }
+
+         boost::string_ref first;
+         TValue& second;
+      };
+
+      template <typename TName, typename TValue>
+      TValue& json_member_value(std::pair<TName, TValue>& member)
+      {
+         return member.second;
+      }
+
+      template <typename TName, typename TValue>
+      const TValue& json_member_value(const std::pair<TName, TValue>& member)
+      {
+         return member.second;
+      }
+
+      template <typename TValue>
+      TValue& json_member_value(TValue& value)
+      {
+         return value;
+      }
+
+      /// Bidirectional iterator yielding members by value as a
+      /// json_member_ref, so that names can not be modified. Names are
+      /// taken from the first of the pairs iterated by TNames, values
+      /// from the pairs, or values, iterated by TValues, which may be
+      /// the same iterator type. Every object storage uses it for both
+      /// its iterator and const_iterator, so that mutable and const
+      /// ranges yield members alike, and an iterator converts to a
+      /// const_iterator.
+      template <typename TValue, typename TNames, typename TValues>
+      class json_member_iterator
+      {
+      public:
+         typedef std::bidirectional_iterator_tag iterator_category;
+         typedef json_member_ref<TValue> value_type;
+         typedef std::ptrdiff_t difference_type;
+         typedef value_type reference;
+
+         struct pointer
+         {
+            explicit pointer(const value_type& member)
+               : member(member)
+            {
+            }
+
+            const value_type* operator->() const
+            {
+               return &member;
+            }
+
+            value_type member;
+         };
+
+         json_member_iterator()
+         {
+         }
+
+         json_member_iterator(TNames name, TValues value)
+            : name(name)
+            , value(value)
+         {
+         }
+
+         template <typename TOtherValue, typename TOtherNames, typename TOtherValues>
+         json_member_iterator(const json_member_iterator<TOtherValue, TOtherNames, TOtherValues>& rhs,
+            typename boost::enable_if_c<boost::is_convertible<TOtherNames, TNames>::value && boost::is_convertible<TOtherValues, TValues>::value>::type* = 0)
+            : name(rhs.name)
+            , value(rhs.value)
+         {
+         }
+
+         reference operator*() const
+         {
+            return value_type(boost::string_ref(name->first.data(), name->first.size()), json_member_value(*value));
+         }
+
+         pointer operator->() const
+         {
+            return pointer(**this);
+         }
+
+         json_member_iterator& operator++()
+         {
+            ++name;
+            ++value;
+            return *this;
+         }
+
+         json_member_iterator operator++(int)
+         {
+            json_member_iterator i(*this);
+            ++*this;
+            return i;
+         }
+
+         json_member_iterator& operator--()
+         {
+            --name;
+            --value;
+            return *this;
+         }
+
+         json_member_iterator operator--(int)
+         {
+            json_member_iterator i(*this);
+            --*this;
+            return i;
+         }
+
+         bool operator==(const json_member_iterator& rhs) const
+         {
+            return value == rhs.value;
+         }
+
+         bool operator!=(const json_member_iterator& rhs) const
+         {
+            return value != rhs.value;
+         }
+
+      private:
+         template <typename TOtherValue, typename TOtherNames, typename TOtherValues>
+         friend class json_member_iterator;
+
+         TNames name;
+         TValues value;
+      };
+
+      /// Object members in a contiguous vector. While the object has at most
+      /// TThreshold members they are kept sorted by name and found by binary
+      /// search. Beyond that they are kept in insertion order and found
+      /// through an open addressing hash index.
+      ///
+      /// References to members are invalidated by inserting or erasing
+      /// members of the same object.
+      template <typename TValue, size_t TThreshold, typename TAllocator>
+      class json_member_vector
+      {
+      public:
+         typedef TAllocator allocator_type;
+         typedef typename json_allocator_traits<TAllocator>::string_type key_type;
+         typedef std::pair<key_type, TValue> value_type;
+         typedef typename json_allocator_traits<TAllocator>::template vector<value_type>::type member_vector;
+         typedef json_member_iterator<const TValue, typename member_vector::const_iterator, typename member_vector::const_iterator> const_iterator;
+         typedef json_member_iterator<TValue, typename member_vector::iterator, typename member_vector::iterator> iterator;
+
+         /// Iterator over the members as pairs, for json_shape, whose names
+         /// are iterated alongside values kept elsewhere.
+         typedef typename member_vector::const_iterator const_pair_iterator;
+
+         explicit json_member_vector(const TAllocator& alloc)
+            : members(alloc)
+            , slots(alloc)
+         {
+         }
+
+         /// Replaces the members with copies of the members of rhs, keeping the allocator.
+         void assign(const json_member_vector& rhs)
+         {
+            members.clear();
+            members.reserve(rhs.members.size());
+            for (typename member_vector::const_iterator i = rhs.members.begin(), e = rhs.members.end(); i != e; ++i)
+            {
+               members.push_back(empty_member());
+               members.back().first.assign(i->first.data(), i->first.size());
+               members.back().second = i->second;
+            }
+
+            slots = rhs.slots;
+         }
+
+         size_t size() const
+         {
+            return members.size();
+         }
+
+         /// True if iteration is ordered by name.
+         bool ordered() const
+         {
+            return slots.empty();
+         }
+
+         /// Prepares an empty object for members named as those of like.
+         void prepare(const json_member_vector& like)
+         {
+            members.reserve(like.members.size());
+         }
+
+         const_iterator begin() const
+         {
+            return const_iterator(members.begin(), members.begin());
+         }
+
+         const_iterator end() const
+         {
+            return const_iterator(members.end(), members.end());
+         }
+
+         iterator begin()
+         {
+            return iterator(members.begin(), members.begin());
+         }
+
+         iterator end()
+         {
+            return iterator(members.end(), members.end());
+         }
+
+         const_pair_iterator pairs_begin() const
+         {
+            return members.begin();
+         }
+
+         const TValue* find(boost::string_ref name) const
+         {
+            const size_t i = index_of(name);
+            return i != npos ? &members[i].second : 0;
+         }
+
+         TValue* find(boost::string_ref name)
+         {
+            const size_t i = index_of(name);
+            return i != npos ? &members[i].second : 0;
+         }
+
+         const TValue* find(const json_key& key) const
+         {
+            const size_t i = index_of(key.get_name(), key.get_hash());
+            return i != npos ? &members[i].second : 0;
+         }
+
+         /// Stores the member named by each key, or 0, in children[key number].
+         void find_all(const json_key_set& keys, const TValue** children) const
+         {
+            if (!ordered())
+            {
+               for (size_t k = 0; k != keys.size(); ++k)
+               {
+                  const size_t i = index_of(keys.get_key(k).get_name(), keys.get_key(k).get_hash());
+                  children[k] = i != npos ? &members[i].second : 0;
+               }
+
+               return;
+            }
+
+            // Both sides are sorted by name, each search starts where the previous ended.
+            size_t first = 0;
+            for (size_t rank = 0; rank != keys.size(); ++rank)
+            {
+               const size_t k = keys.get_position(rank);
+               const boost::string_ref name = keys.get_key(k).get_name();
+               first = lower_bound(name, first);
+               children[k] = first != members.size() && name == key_ref(first) ? &members[first].second : 0;
+            }
+         }
+
+         /// Returns the member with the given name, inserting a null member if needed.
+         TValue& insert(boost::string_ref name)
+         {
+            if (ordered())
+            {
+               const size_t i = lower_bound(name);
+               if (i != members.size() && name == key_ref(i))
+               {
+                  return members[i].second;
+               }
+
+               if (members.size() < TThreshold)
+               {
+                  append(name);
+                  for (size_t j = members.size() - 1; j != i; --j)
+                  {
+                     swap_members(j, j - 1);
+                  }
+
+                  return members[i].second;
+               }
+
+               rehash(initial_capacity(members.size() + 1));
+            }
+
+            const boost::uint32_t hash = json_hash_name(name);
+            const size_t s = probe(name, hash);
+            if (slots[s].index != 0)
+            {
+               return members[slots[s].index - 1].second;
+            }
+
+            append(name);
+            if (members.size() * 4 > slots.size() * 3)
+            {
+               rehash(slots.size() * 2);
+            }
+            else
+            {
+               slots[s].hash = hash;
+               slots[s].index = static_cast<boost::uint32_t>(members.size());
+            }
+
+            return members.back().second;
+         }
+
+         bool erase(boost::string_ref name)
+         {
+            const size_t i = index_of(name);
+            if (i == npos)
+            {
+               return false;
+            }
+
+            if (!ordered())
+            {
+               unlink(probe(name, json_hash_name(name)), i);
+            }
+
+            for (size_t j = i + 1; j < members.size(); ++j)
+            {
+               swap_members(j - 1, j);
+            }
+
+            members.pop_back();
+            return true;
+         }
+
+      private:
+         static const size_t npos = static_cast<size_t>(-1);
+
+         struct slot
+         {
+            slot()
+               : hash(0)
+               , index(0)
+            {
+            }
+
+            boost::uint32_t hash;
+            boost::uint32_t index; // member position + 1, 0 if empty
+         };
+
+         static size_t initial_capacity(size_t size)
+         {
+            size_t capacity = 16;
+            while (size * 4 > capacity * 3)
+            {
+               capacity *= 2;
+            }
+
+            return capacity;
+         }
+
+         size_t index_of(boost::string_ref name) const
+         {
+            return index_of(name, ordered() ? 0 : json_hash_name(name));
+         }
+
+         /// Finds a member given the hash of its name, which only the hash index uses.
+         size_t index_of(boost::string_ref name, boost::uint32_t hash) const
+         {
+            if (ordered())
+            {
+               const size_t i = lower_bound(name);
+               return i != members.size() && name == key_ref(i) ? i : npos;
+            }
+
+            const size_t s = probe(name, hash);
+            return slots[s].index != 0 ? slots[s].index - 1 : npos;
+         }
+
+         size_t lower_bound(boost::string_ref name, size_t first = 0) const
+         {
+            size_t count = members.size() - first;
+            while (count != 0)
+            {
+               const size_t step = count / 2;
+               if (key_ref(first + step) < name)
+               {
+                  first += step + 1;
+                  count -= step + 1;
+               }
+               else
+               {
+                  count = step;
+               }
+            }
+
+            return first;
+         }
+
+         /// Returns the slot holding name, or the empty slot where it belongs.
+         size_t probe(boost::string_ref name, boost::uint32_t hash) const
+         {
+            const size_t mask = slots.size() - 1;
+            for (size_t s = hash & mask;; s = (s + 1) & mask)
+            {
+               const slot& candidate = slots[s];
+               if (candidate.index == 0)
+               {
+                  return s;
+               }
+
+               if (candidate.hash == hash && name == key_ref(candidate.index - 1))
+               {
+                  return s;
+               }
+            }
+         }
+
+         /// Rebuilds the hash index with the given power of two capacity.
+         void rehash(size_t capacity)
+         {
+            slots.assign(capacity, slot());
+
+            const size_t mask = capacity - 1;
+            for (size_t i = 0; i < members.size(); ++i)
+            {
+               const boost::uint32_t hash = json_hash_name(key_ref(i));
+               size_t s = hash & mask;
+               while (slots[s].index != 0)
+               {
+                  s = (s + 1) & mask;
+               }
+
+               slots[s].hash = hash;
+               slots[s].index = static_cast<boost::uint32_t>(i + 1);
+            }
+         }
+
+         /// Empties slot s, holding the member at position i, without leaving
+         /// a gap in the probe sequences of the slots following it, and moves
+         /// the indexes of the members after i one position down, as erasing
+         /// the member does with the members.
+         void unlink(size_t s, size_t i)
+         {
+            const size_t mask = slots.size() - 1;
+            size_t hole = s;
+            for (size_t t = (s + 1) & mask; slots[t].index != 0; t = (t + 1) & mask)
+            {
+               // The slot fills the hole unless it belongs after the hole.
+               const size_t home = slots[t].hash & mask;
+               if (((t - home) & mask) >= ((t - hole) & mask))
+               {
+                  slots[hole] = slots[t];
+                  hole = t;
+               }
+            }
+
+            slots[hole] = slot();
+
+            for (size_t t = 0; t != slots.size(); ++t)
+            {
+               if (slots[t].index > i + 1)
+               {
+                  --slots[t].index;
+               }
+            }
+         }
+
+         /// Appends a null member, growing by swapping rather than copying the members.
+         void append(boost::string_ref name)
+         {
+            if (members.size() == members.capacity())
+            {
+               member_vector grown(members.get_allocator());
+               grown.reserve(members.empty() ? 4 : members.size() * 2);
+               for (size_t i = 0; i < members.size(); ++i)
+               {
+                  grown.push_back(empty_member());
+                  grown[i].first.swap(members[i].first);
+                  grown[i].second.swap(members[i].second);
+               }
+
+               members.swap(grown);
+            }
+
+            members.push_back(empty_member());
+            members.back().first.assign(name.data(), name.size());
+         }
+
+         /// A null member whose name uses the allocator of the object.
+         value_type empty_member() const
+         {
+            return value_type(key_type(members.get_allocator()), TValue());
+         }
+
+         boost::string_ref key_ref(size_t i) const
+         {
+            return boost::string_ref(members[i].first.data(), members[i].first.size());
+         }
+
+         void swap_members(size_t i, size_t j)
+         {
+            members[i].first.swap(members[j].first);
+            members[i].second.swap(members[j].second);
+         }
+
+         member_vector members;
+         typename json_allocator_traits<TAllocator>::template vector<slot>::type slots;
+      };
+
+      template <typename TValue, size_t TThreshold, typename TAllocator>
+      void json_assign(json_member_vector<TValue, TThreshold, TAllocator>& dst, const json_member_vector<TValue, TThreshold, TAllocator>& src)
+      {
+         dst.assign(src);
+      }
+
+      /// Orders member names of any string type, without converting them.
+      struct json_name_less
+      {
+         typedef void is_transparent;
+
+         template <typename TLhs, typename TRhs>
+         bool operator()(const TLhs& lhs, const TRhs& rhs) const
+         {
+            return boost::string_ref(lhs.data(), lhs.size()) < boost::string_ref(rhs.data(), rhs.size());
+         }
+      };
+
+      /// Object members in a map, ordered by name. The map is a
+      /// Boost.Container map, whatever the allocator, as it finds members
+      /// by names of another type than the key through json_name_less.
+      template <typename TValue, typename TAllocator>
+      class json_member_map
+      {
+      public:
+         typedef TAllocator allocator_type;
+         typedef typename json_allocator_traits<TAllocator>::string_type key_type;
+         typedef boost::container::map<key_type, TValue, json_name_less, typename json_allocator_traits<TAllocator>::template rebind< std::pair<const key_type, TValue> >::type> map_type;
+         typedef typename map_type::value_type value_type;
+         typedef json_member_iterator<const TValue, typename map_type::const_iterator, typename map_type::const_iterator> const_iterator;
+         typedef json_member_iterator<TValue, typename map_type::iterator, typename map_type::iterator> iterator;
+
+         explicit json_member_map(const TAllocator& alloc)
+            : members(json_name_less(), alloc)
+         {
+         }
+
+         /// Replaces the members with copies of the members of rhs, keeping the allocator.
+         void assign(const json_member_map& rhs)
+         {
+            members.clear();
+            for (typename map_type::const_iterator i = rhs.members.begin(), e = rhs.members.end(); i != e; ++i)
+            {
+               insert(boost::string_ref(i->first.data(), i->first.size())) = i->second;
+            }
+         }
+
+         size_t size() const
+         {
+            return members.size();
+         }
+
+         bool ordered() const
+         {
+            return true;
+         }
+
+         void prepare(const json_member_map& /*like*/)
+         {
+         }
+
+         const_iterator begin() const
+         {
+            return const_iterator(members.begin(), members.begin());
+         }
+
+         const_iterator end() const
+         {
+            return const_iterator(members.end(), members.end());
+         }
+
+         iterator begin()
+         {
+            return iterator(members.begin(), members.begin());
+         }
+
+         iterator end()
+         {
+            return iterator(members.end(), members.end());
+         }
+
+         const TValue* find(boost::string_ref name) const
+         {
+            const typename map_type::const_iterator i = members.find(name);
+            return i != members.end() ? &i->second : 0;
+         }
+
+         TValue* find(boost::string_ref name)
+         {
+            const typename map_type::iterator i = members.find(name);
+            return i != members.end() ? &i->second : 0;
+         }
+
+         const TValue* find(const json_key& key) const
+         {
+            return find(key.get_name());
+         }
+
+         void find_all(const json_key_set& keys, const TValue** children) const
+         {
+            for (size_t k = 0; k != keys.size(); ++k)
+            {
+               children[k] = find(keys.get_key(k).get_name());
+            }
+         }
+
+         /// Returns the member with the given name, inserting a null member
+         /// if needed. The name is only copied when a member is inserted.
+         TValue& insert(boost::string_ref name)
+         {
+            const typename map_type::iterator i = members.lower_bound(name);
+            if (i != members.end() && !members.key_comp()(name, i->first))
+            {
+               return i->second;
+            }
+
+            return members.insert(i, value_type(key(name), TValue()))->second;
+         }
+
+         bool erase(boost::string_ref name)
+         {
+            const typename map_type::iterator i = members.find(name);
+            if (i == members.end())
+            {
+               return false;
+            }
+
+            members.erase(i);
+            return true;
+         }
+
+      private:
+         key_type key(boost::string_ref name) const
+         {
+            return key_type(name.data(), name.size(), members.get_allocator());
+         }
+
+         map_type members;
+      };
+
+      template <typename TValue, typename TAllocator>
+      void json_assign(json_member_map<TValue, TAllocator>& dst, const json_member_map<TValue, TAllocator>& src)
+      {
+         dst.assign(src);
+      }
+
+      /// Position of a name in a json_shape.
+      struct json_shape_position
+      {
+         json_shape_position()
+            : index(0)
+         {
+         }
+
+         void swap(json_shape_position& rhs)
+         {
+            std::swap(index, rhs.index);
+         }
+
+         boost::uint32_t index;
+      };
+
+      /// Member names of objects in insertion order, shared between all
+      /// objects with the same names in the same order. Shapes are never
+      /// modified once shared, objects which need other names move to a new
+      /// shape.
+      template <typename TAllocator>
+      struct json_shape
+      {
+         typedef TAllocator allocator_type;
+
+         explicit json_shape(const TAllocator& alloc)
+            : refs(0)
+            , alloc(alloc)
+            , names(alloc)
+         {
+         }
+
+         size_t size() const
+         {
+            return names.size();
+         }
+
+         typedef json_member_vector<json_shape_position, 0, TAllocator> names_type;
+
+         typename names_type::const_pair_iterator begin() const
+         {
+            return names.pairs_begin();
+         }
+
+         boost::string_ref name(size_t i) const
+         {
+            const typename names_type::const_pair_iterator name = begin() + i;
+            return boost::string_ref(name->first.data(), name->first.size());
+         }
+
+         void push_back(boost::string_ref name)
+         {
+            const boost::uint32_t index = static_cast<boost::uint32_t>(names.size());
+            names.insert(name).index = index;
+         }
+
+         bool unique() const
+         {
+            return refs.load(boost::memory_order_acquire) == 1;
+         }
+
+         mutable boost::atomic<unsigned> refs;
+         TAllocator alloc;
+         names_type names;
+
+      private:
+         json_shape(const json_shape&);
+         json_shape& operator=(const json_shape&);
+      };
+
+      template <typename TAllocator>
+      void intrusive_ptr_add_ref(const json_shape<TAllocator>* shape)
+      {
+         shape->refs.fetch_add(1, boost::memory_order_relaxed);
+      }
+
+      template <typename TAllocator>
+      void intrusive_ptr_release(const json_shape<TAllocator>* shape)
+      {
+         if (shape->refs.fetch_sub(1, boost::memory_order_release) == 1)
+         {
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            json_delete_node(const_cast<json_shape<TAllocator>*>(shape));
+         }
+      }
+
+      /// Object members as a vector of values, with the names kept in a
+      /// json_shape shared with other objects. Objects prepared from an
+      /// object with the same names, see prepare(), share its shape as long
+      /// as members are inserted in the same order, so arrays of records
+      /// store each name once rather than once per record. Any other
+      /// insertion, or erasing a member, moves the object to a shape of
+      /// its own.
+      ///
+      /// Members are iterated in insertion order, see json_member_iterator.
+      template <typename TValue, typename TAllocator>
+      class json_shaped_members
+      {
+      public:
+         typedef TAllocator allocator_type;
+         typedef json_shape<TAllocator> shape_type;
+         typedef json_member_ref<const TValue> value_type;
+         typedef typename json_allocator_traits<TAllocator>::template vector<TValue>::type value_vector;
+         typedef json_member_iterator<const TValue, typename shape_type::names_type::const_pair_iterator, typename value_vector::const_iterator> const_iterator;
+         typedef json_member_iterator<TValue, typename shape_type::names_type::const_pair_iterator, typename value_vector::iterator> iterator;
+
+         explicit json_shaped_members(const TAllocator& alloc)
+            : values(alloc)
+         {
+         }
+
+         /// Replaces the members with copies of the members of rhs, keeping
+         /// the allocator. The shape of rhs is shared if it uses the same
+         /// allocator.
+         void assign(const json_shaped_members& rhs)
+         {
+            values.assign(rhs.values.begin(), rhs.values.end());
+            if (!rhs.shape || rhs.shape->alloc == allocator())
+               shape = rhs.shape;
+            else
+               shape = copy_shape(*rhs.shape, rhs.values.size(), npos);
+         }
+
+         size_t size() const
+         {
+            return values.size();
+         }
+
+         bool ordered() const
+         {
+            return false;
+         }
+
+         /// Prepares an empty object for members named as those of like,
+         /// sharing its shape.
+         void prepare(const json_shaped_members& like)
+         {
+            if (!like.shape || like.shape->alloc != allocator())
+               return;
+
+            shape = like.shape;
+            values.reserve(like.values.size());
+         }
+
+         const_iterator begin() const
+         {
+            return shape ? const_iterator(shape->begin(), values.begin()) : const_iterator();
+         }
+
+         const_iterator end() const
+         {
+            return shape ? const_iterator(shape->begin() + values.size(), values.end()) : const_iterator();
+         }
+
+         iterator begin()
+         {
+            return shape ? iterator(shape->begin(), values.begin()) : iterator();
+         }
+
+         iterator end()
+         {
+            return shape ? iterator(shape->begin() + values.size(), values.end()) : iterator();
+         }
+
+         const TValue* find(boost::string_ref name) const
+         {
+            const size_t i = index_of(name);
+            return i != npos ? &values[i] : 0;
+         }
+
+         TValue* find(boost::string_ref name)
+         {
+            const size_t i = index_of(name);
+            return i != npos ? &values[i] : 0;
+         }
+
+         /// Tries the position the key was last found at before the shape index.
+         const TValue* find(const json_key& key) const
+         {
+            const size_t hint = key.get_hint();
+            if (hint < values.size() && shape->name(hint) == key.get_name())
+               return &values[hint];
+
+            const json_shape_position* position = shape ? shape->names.find(key) : 0;
+            if (!position || position->index >= values.size())
+               return 0;
+
+            key.set_hint(position->index);
+            return &values[position->index];
+         }
+
+         void find_all(const json_key_set& keys, const TValue** children) const
+         {
+            for (size_t k = 0; k != keys.size(); ++k)
+            {
+               children[k] = find(keys.get_key(k));
+            }
+         }
+
+         /// Returns the member with the given name, inserting a null member
+         /// if needed. The shape is kept if it names the member next,
+         /// extended if the object owns it, and replaced otherwise.
+         TValue& insert(boost::string_ref name)
+         {
+            if (TValue* value = find(name))
+               return *value;
+
+            const size_t size = values.size();
+            if (!shape)
+               shape = json_new_node<shape_type>(allocator());
+            else if (size < shape->size() ? shape->name(size) != name : !shape->unique())
+               shape = copy_shape(*shape, size, npos);
+
+            if (shape->size() == size)
+               shape->push_back(name);
+
+            append();
+            return values.back();
+         }
+
+         bool erase(boost::string_ref name)
+         {
+            const size_t i = index_of(name);
+            if (i == npos)
+               return false;
+
+            for (size_t j = i + 1; j < values.size(); ++j)
+            {
+               values[j - 1].swap(values[j]);
+            }
+
+            values.pop_back();
+
+            // Names past the last member are ignored, erasing it keeps the shape.
+            if (i != values.size())
+               shape = copy_shape(*shape, values.size() + 1, i);
+
+            return true;
+         }
+
+      private:
+         static const size_t npos = static_cast<size_t>(-1);
+
+         TAllocator allocator() const
+         {
+            return TAllocator(values.get_allocator());
+         }
+
+         size_t index_of(boost::string_ref name) const
+         {
+            const json_shape_position* position = shape ? shape->names.find(name) : 0;
+            return position && position->index < values.size() ? position->index : npos;
+         }
+
+         /// Returns a new shape with the first count names of from, except the one at skip.
+         boost::intrusive_ptr<shape_type> copy_shape(const shape_type& from, size_t count, size_t skip) const
+         {
+            boost::intrusive_ptr<shape_type> to(json_new_node<shape_type>(allocator()));
+            for (size_t i = 0; i < count; ++i)
+            {
+               if (i != skip)
+                  to->push_back(from.name(i));
+            }
+
+            return to;
+         }
+
+         /// Appends a null value, growing by swapping rather than copying the values.
+         void append()
+         {
+            if (values.size() == values.capacity())
+            {
+               value_vector grown(values.get_allocator());
+               grown.reserve(values.empty() ? 4 : values.size() * 2);
+               for (size_t i = 0; i < values.size(); ++i)
+               {
+                  grown.push_back(TValue());
+                  grown[i].swap(values[i]);
+               }
+
+               values.swap(grown);
+            }
+
+            values.push_back(TValue());
+         }
+
+         boost::intrusive_ptr<shape_type> shape;
+         value_vector values;
+      };
+
+      template <typename TValue, typename TAllocator>
+      void json_assign(json_shaped_members<TValue, TAllocator>& dst, const json_shaped_members<TValue, TAllocator>& src)
+      {
+         dst.assign(src);
+      }
+   }
+
+   /// Object storage policy for basic_json_value keeping the members in a
+   /// contiguous vector, sorted by name while the object has at most
+   /// TThreshold members and hashed in insertion order beyond that.
+   /// Small objects are then cheap to build and search, and large objects
+   /// still have constant time lookups.
+   template <size_t TThreshold = 32>
+   struct json_adaptive_objects
+   {
+      template <typename TValue, typename TAllocator = std::allocator<char> >
+      struct container
+      {
+         typedef detail::json_member_vector<TValue, TThreshold, TAllocator> type;
+      };
+   };
+
+   /// Object storage policy keeping the members in a vector sorted by name.
+   struct json_flat_objects : json_adaptive_objects<static_cast<size_t>(-1)>
+   {
+   };
+
+   /// Object storage policy keeping the members in insertion order, indexed
+   /// by a hash table.
+   struct json_hashed_objects : json_adaptive_objects<0>
+   {
+   };
+
+   /// Object storage policy keeping the members in a map, ordered by name.
+   struct json_map_objects
+   {
+      template <typename TValue, typename TAllocator = std::allocator<char> >
+      struct container
+      {
+         typedef detail::json_member_map<TValue, TAllocator> type;
+      };
+   };
+
+   /// Object storage policy keeping the member names in shapes shared by
+   /// objects with the same names in the same order, and only the values
+   /// in each object. Suits arrays of uniformly keyed records, where
+   /// json_builder gives every record the shape of the one before it.
+   /// Lookups by a json_key remember the position of the member, so
+   /// looking up the same key in each record skips the shape index.
+   struct json_shaped_objects
+   {
+      template <typename TValue, typename TAllocator = std::allocator<char> >
+      struct container
+      {
+         typedef detail::json_shaped_members<TValue, TAllocator> type;
+      };
+   };
+}
+
+#endif
@@ -10,59 +10,110 @@
 #include "json_value.h"
 #include <sstream>
 #include <stack>
-#include <math.h>
+#include <vector>
 
 namespace adhd
 {
-   /// Visitor for building a JSON value.
-   struct json_builder
+   namespace detail
    {
-      std::stack<json_value*> s;
-      json_value keyvalue;
+      /// Significant digits json_parser keeps of a number, enough to round
+      /// any double correctly. Further digits only matter by being zero or
+      /// not, and are replaced by a single digit 1 if any is not zero.
+      const size_t json_max_digits = 800;
+
+      /// Returns the double nearest to the length decimal digits at digits
+      /// times ten to the power exponent, rounding halfway cases to even,
+      /// whatever the locale.
+      ADHD_JSON_API double json_decimal_to_double(const char* digits, size_t length, long exponent);
+   }
+
+   /// Visitor for building a JSON value. Strings, arrays and objects are
+   /// allocated with the allocator given to the constructor.
+   ///
+   /// Non-empty arrays holding only numbers are built packed, see
+   /// basic_json_value::pack. The elements of the innermost open array are
+   /// collected in numbers, with a null entry on the stack for the element
+   /// being built, until an element other than a number turns the array
+   /// into an array of values.
+   ///
+   /// Each object is prepared from the last object completed at the same
+   /// depth, see basic_json_value(json_object, like), as records in an
+   /// array usually have the same members. The objects completed are
+   /// pointed to in likes, not copied, and forgotten once a repeated name
+   /// replaces the member holding them.
+   template <typename TValue>
+   struct basic_json_builder
+   {
+      typedef typename TValue::allocator_type allocator_type;
+
+      std::stack<TValue*> s;
+      TValue keyvalue;
       std::string key;
+      std::vector<double> numbers;
+      bool packing;
+      std::vector<const typename TValue::object_type*> likes;
+      allocator_type alloc;
 
-      json_builder(json_value& root)
+      basic_json_builder(TValue& root, const allocator_type& alloc = allocator_type())
          : s()
+         , packing(false)
+         , alloc(alloc)
       {
          s.push(&root);
       }
 
       void null_value()
       {
-         *s.top() = json_null();
+         target() = json_null();
       }
 
       void string_value(const std::string& val)
       {
-         *s.top() = json_string(val);
+         target() = TValue(json_string(val), alloc);
       }
 
       void number_value(double val)
       {
-         *s.top() = json_number(val);
+         if (s.top())
+            *s.top() = json_number(val);
+         else
+            numbers.push_back(val);
       }
 
       void bool_value(bool val)
       {
-         *s.top() = json_bool(val);
+         target() = json_bool(val);
       }
 
       void begin_array()
       {
-         *s.top() = json_array();
+         target() = TValue(json_array(), alloc);
+         packing = true;
       }
 
       void end_array()
       {
+         if (packing && !numbers.empty())
+            *s.top() = TValue(json_packed_array(&numbers[0], &numbers[0] + numbers.size()), alloc);
+
+         numbers.clear();
+         packing = false;
       }
 
       void begin_object()
       {
-         *s.top() = json_object();
+         TValue& object = target();
+         object = TValue(json_object(), alloc);
+         if (s.size() < likes.size() && likes[s.size()])
+            object.mutable_object().prepare(*likes[s.size()]);
       }
 
       void end_object()
       {
+         if (likes.size() <= s.size())
+            likes.resize(s.size() + 1);
+
+         likes[s.size()] = &s.top()->object();
       }
 
       void begin_key()
@@ -79,17 +130,46 @@ namespace adhd
       void begin_value()
       {
          if (s.top()->is_object())
-            s.push(&s.top()->put_child(key));
+         {
+            TValue& child = s.top()->build_child(key);
+            if (!child.is_null() && likes.size() > s.size() + 1)
+               likes.resize(s.size() + 1);
+
+            s.push(&child);
+         }
+         else if (packing)
+            s.push(0);
          else
-            s.push(&s.top()->append_child());
+            s.push(&s.top()->build_element());
       }
 
       void end_value()
       {
          s.pop();
       }
+
+      /// Returns the value being built, turning the innermost open array
+      /// into an array of values if it is being collected in numbers.
+      TValue& target()
+      {
+         if (!s.top())
+         {
+            s.pop();
+            TValue& array = *s.top();
+            for (std::vector<double>::const_iterator i = numbers.begin(), e = numbers.end(); i != e; ++i)
+               array.build_element() = json_number(*i);
+
+            numbers.clear();
+            packing = false;
+            s.push(&array.build_element());
+         }
+
+         return *s.top();
+      }
    };
 
+   typedef basic_json_builder<json_value> json_builder;
+
    /// Parser to convert a JSON document into a JSON value.
    class json_parser
    {
@@ -107,10 +187,18 @@ namespace adhd
          return root;
       }
 
-      template <typename TIterator>
-      void parse(TIterator iter, json_value& root)
+      template <typename TIterator, typename TLayout, typename TObjects, typename TAllocator>
+      void parse(TIterator iter, basic_json_value<TLayout, TObjects, TAllocator>& root)
+      {
+         basic_json_builder< basic_json_value<TLayout, TObjects, TAllocator> > builder(root);
+         parse(iter, builder);
+      }
+
+      /// Parses into root, allocating its strings, arrays and objects with alloc.
+      template <typename TIterator, typename TLayout, typename TObjects, typename TAllocator>
+      void parse(TIterator iter, basic_json_value<TLayout, TObjects, TAllocator>& root, const TAllocator& alloc)
       {
-         json_builder builder(root);
+         basic_json_builder< basic_json_value<TLayout, TObjects, TAllocator> > builder(root, alloc);
          parse(iter, builder);
       }
 
@@ -398,18 +486,18 @@ namespace adhd
                      }
                      else if (codepoint < 0x800u)
                      {
-                        ss << static_cast<unsigned char>((codepoint >> 6) & 0x1fu | 0xc0u);
+                        ss << static_cast<unsigned char>(((codepoint >> 6) & 0x1fu) | 0xc0u);
                         ss << static_cast<unsigned char>((codepoint & 0x3fu) | 0x80u);
                      }
                      else if (codepoint < 0x10000u)
                      {
-                        ss << static_cast<unsigned char>((codepoint >> 12) & 0x0fu | 0xe0u);
+                        ss << static_cast<unsigned char>(((codepoint >> 12) & 0x0fu) | 0xe0u);
                         ss << static_cast<unsigned char>(((codepoint >> 6) & 0x3fu) | 0x80u);
                         ss << static_cast<unsigned char>((codepoint & 0x3fu) | 0x80u);
                      }
                      else
                      {
-                        ss << static_cast<unsigned char>((codepoint >> 18) & 0x07u | 0xf0u);
+                        ss << static_cast<unsigned char>(((codepoint >> 18) & 0x07u) | 0xf0u);
                         ss << static_cast<unsigned char>(((codepoint >> 12) & 0x3fu) | 0x80u);
                         ss << static_cast<unsigned char>(((codepoint >> 6) & 0x3fu) | 0x80u);
                         ss << static_cast<unsigned char>((codepoint & 0x3fu) | 0x80u);
@@ -440,30 +528,36 @@ namespace adhd
          }
       }
 
-      template <typename TIterator, typename TInteger>
-      void parse_int(TIterator& iter, TInteger& integer)
-      {
-         while (*iter >= '0' && *iter <= '9')
-         {
-            const int digit = *iter++ - '0';
-            integer = integer * 10 + digit;
-         }
-      }
-
+      /// Appends the significant digits at iter to digits, dropping leading
+      /// zeros and digits beyond json_max_digits, and adjusting exponent so
+      /// that the digits times ten to its power keep their value. Digits
+      /// of a fraction lower the exponent. Sets inexact if a digit dropped
+      /// at the end is not zero.
       template <typename TIterator>
-      double parse_fraction(TIterator& iter)
+      void parse_digits(TIterator& iter, char* digits, size_t& length, long& exponent, bool fraction, bool& inexact)
       {
-         double fraction = 0;
-         double factor = 0.1;
-
          while (*iter >= '0' && *iter <= '9')
          {
-            const int digit = *iter++ - '0';
-            fraction = fraction + digit * factor;
-            factor *= 0.1;
+            const char c = *iter++;
+            if (length == 0 && c == '0')
+            {
+               if (fraction)
+                  --exponent;
+            }
+            else if (length < detail::json_max_digits)
+            {
+               digits[length++] = c;
+               if (fraction)
+                  --exponent;
+            }
+            else
+            {
+               if (!fraction)
+                  ++exponent;
+               if (c != '0')
+                  inexact = true;
+            }
          }
-
-         return fraction;
       }
 
       template <typename TIterator, typename TVisitor>
@@ -476,7 +570,12 @@ namespace adhd
             ++iter;
          }
 
-         double number = 0;
+         // The significant digits, read as an integer, times ten to the
+         // power of exponent make up the number.
+         char digits[detail::json_max_digits + 1];
+         size_t length = 0;
+         long exponent = 0;
+         bool inexact = false;
 
          // Is it zero or an integer?
          if (*iter == '0')
@@ -485,7 +584,7 @@ namespace adhd
          }
          else if (*iter >= '1' && *iter <= '9')
          {
-            parse_int(iter, number);
+            parse_digits(iter, digits, length, exponent, false, inexact);
          }
          else
          {
@@ -503,8 +602,7 @@ namespace adhd
                throw json_parse_exception("expected fraction");
             }
 
-            // Parse and add fraction.
-            number += parse_fraction(iter);
+            parse_digits(iter, digits, length, exponent, true, inexact);
          }
 
          // Is it an exponent?
@@ -525,12 +623,26 @@ namespace adhd
                throw json_parse_exception("expected exponent");
             }
 
-            // Parse and apply exponent.
-            int exponent = 0;
-            parse_int(iter, exponent);
-            number *= pow(10.0, negative_exponent ? -exponent : exponent);
+            // Larger exponents give zero or infinity all the same.
+            long written = 0;
+            while (*iter >= '0' && *iter <= '9')
+            {
+               const int digit = *iter++ - '0';
+               if (written < 100000000)
+                  written = written * 10 + digit;
+            }
+
+            exponent += negative_exponent ? -written : written;
          }
 
+         // A digit below the last one kept stands for the digits dropped.
+         if (inexact)
+         {
+            digits[length++] = '1';
+            --exponent;
+         }
+
+         const double number = detail::json_decimal_to_double(digits, length, exponent);
          visitor.number_value(minus ? -number : number);
       }
 
@@ -578,6 +690,39 @@ namespace adhd
          }
       }
    };
+
+   /// Visitor ignoring every value, for checking a document with
+   /// json_parser without building it.
+   struct json_null_visitor
+   {
+      void null_value() {}
+      void string_value(const std::string&) {}
+      void number_value(double) {}
+      void bool_value(bool) {}
+      void begin_array() {}
+      void end_array() {}
+      void begin_object() {}
+      void end_object() {}
+      void begin_key() {}
+      void end_key() {}
+      void begin_value() {}
+      void end_value() {}
+   };
+
+   namespace detail
+   {
+      inline void json_validate_raw(const char* text)
+      {
+         json_null_visitor visitor;
+         json_parser().parse(text, visitor);
+      }
+
+      template <typename TValue>
+      void json_parse_raw(const char* text, TValue& value, const typename TValue::allocator_type& alloc)
+      {
+         json_parser().parse(text, value, alloc);
+      }
+   }
 }
 
 #endif
@@ -0,0 +1,709 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "json_persistent_value.h"
+
+namespace adhd
+{
+   namespace detail
+   {
+      json_persistent_node::~json_persistent_node()
+      {
+      }
+
+      json_persistent_string::~json_persistent_string()
+      {
+      }
+
+      json_persistent_leaf::~json_persistent_leaf()
+      {
+      }
+
+      json_persistent_branch::~json_persistent_branch()
+      {
+      }
+
+      json_persistent_array::~json_persistent_array()
+      {
+      }
+
+      json_persistent_hamt::~json_persistent_hamt()
+      {
+      }
+
+      json_persistent_object::~json_persistent_object()
+      {
+      }
+   }
+
+   namespace
+   {
+      using detail::json_persistent_node;
+      using detail::json_persistent_leaf;
+      using detail::json_persistent_branch;
+      using detail::json_persistent_hamt;
+      using detail::json_persistent_member;
+
+      typedef boost::intrusive_ptr<json_persistent_node> node_ptr;
+      typedef boost::intrusive_ptr<json_persistent_hamt> hamt_ptr;
+
+      enum
+      {
+         bits_per_level = 5,
+         branch_factor = 1 << bits_per_level,
+         level_mask = branch_factor - 1,
+
+         /// Shift at which the hash bits are exhausted and members collide.
+         collision_shift = 35,
+      };
+
+      /// Returns the node in slot, first copying it if it is shared or creating it if empty.
+      template <typename TNode, typename TPtr>
+      TNode& make_unique(TPtr& slot)
+      {
+         if (!slot)
+         {
+            slot.reset(new TNode());
+         }
+         else if (!slot->unique())
+         {
+            slot.reset(new TNode(*static_cast<TNode*>(slot.get())));
+         }
+
+         return *static_cast<TNode*>(slot.get());
+      }
+
+      unsigned popcount(boost::uint32_t x)
+      {
+         x = x - ((x >> 1) & 0x55555555u);
+         x = (x & 0x33333333u) + ((x >> 2) & 0x33333333u);
+         return (((x + (x >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+      }
+
+      const json_persistent_value& vector_get(const json_persistent_node* node, unsigned shift, size_t i)
+      {
+         for (; shift > 0; shift -= bits_per_level)
+         {
+            node = static_cast<const json_persistent_branch*>(node)->children[(i >> shift) & level_mask].get();
+         }
+
+         return static_cast<const json_persistent_leaf*>(node)->items[i & level_mask];
+      }
+
+      void vector_assign(node_ptr& slot, unsigned shift, size_t i, const json_persistent_value& val)
+      {
+         if (shift == 0)
+         {
+            make_unique<json_persistent_leaf>(slot).items[i & level_mask] = val;
+            return;
+         }
+
+         json_persistent_branch& branch = make_unique<json_persistent_branch>(slot);
+         vector_assign(branch.children[(i >> shift) & level_mask], shift - bits_per_level, i, val);
+      }
+
+      /// Appends val as element i, which must be the current size.
+      void vector_push(node_ptr& slot, unsigned shift, size_t i, const json_persistent_value& val)
+      {
+         if (shift == 0)
+         {
+            make_unique<json_persistent_leaf>(slot).items.push_back(val);
+            return;
+         }
+
+         json_persistent_branch& branch = make_unique<json_persistent_branch>(slot);
+         const size_t k = (i >> shift) & level_mask;
+         if (k == branch.children.size())
+         {
+            branch.children.push_back(node_ptr());
+         }
+
+         vector_push(branch.children[k], shift - bits_per_level, i, val);
+      }
+
+      /// Removes element i, which must be the last element.
+      void vector_pop(node_ptr& slot, unsigned shift, size_t i)
+      {
+         if (shift == 0)
+         {
+            json_persistent_leaf& leaf = make_unique<json_persistent_leaf>(slot);
+            leaf.items.pop_back();
+            if (leaf.items.empty())
+            {
+               slot.reset();
+            }
+
+            return;
+         }
+
+         json_persistent_branch& branch = make_unique<json_persistent_branch>(slot);
+         const size_t k = (i >> shift) & level_mask;
+         vector_pop(branch.children[k], shift - bits_per_level, i);
+         if (!branch.children[k])
+         {
+            branch.children.pop_back();
+            if (branch.children.empty())
+            {
+               slot.reset();
+            }
+         }
+      }
+
+      bool vector_equal(const json_persistent_node* lhs, const json_persistent_node* rhs, unsigned shift)
+      {
+         if (lhs == rhs)
+            return true;
+
+         if (!lhs || !rhs)
+            return false;
+
+         if (shift == 0)
+         {
+            return static_cast<const json_persistent_leaf*>(lhs)->items == static_cast<const json_persistent_leaf*>(rhs)->items;
+         }
+
+         const std::vector<node_ptr>& l = static_cast<const json_persistent_branch*>(lhs)->children;
+         const std::vector<node_ptr>& r = static_cast<const json_persistent_branch*>(rhs)->children;
+         if (l.size() != r.size())
+            return false;
+
+         for (size_t i = 0; i < l.size(); ++i)
+         {
+            if (!vector_equal(l[i].get(), r[i].get(), shift - bits_per_level))
+               return false;
+         }
+
+         return true;
+      }
+
+      const json_persistent_member* hamt_find(const json_persistent_hamt* node, boost::string_ref name, boost::uint32_t hash)
+      {
+         for (unsigned shift = 0; node; shift += bits_per_level)
+         {
+            if (shift >= collision_shift)
+            {
+               for (size_t i = 0; i < node->data.size(); ++i)
+               {
+                  if (node->data[i].name.get_string_ref() == name)
+                     return &node->data[i];
+               }
+
+               return 0;
+            }
+
+            const boost::uint32_t bit = 1u << ((hash >> shift) & level_mask);
+            if (node->datamap & bit)
+            {
+               const json_persistent_member& member = node->data[popcount(node->datamap & (bit - 1))];
+               return member.hash == hash && member.name.get_string_ref() == name ? &member : 0;
+            }
+
+            if (!(node->nodemap & bit))
+               return 0;
+
+            node = node->nodes[popcount(node->nodemap & (bit - 1))].get();
+         }
+
+         return 0;
+      }
+
+      /// Sets the member, returns true if it was added.
+      bool hamt_assign(hamt_ptr& slot, unsigned shift, const json_persistent_member& member)
+      {
+         json_persistent_hamt& node = make_unique<json_persistent_hamt>(slot);
+
+         if (shift >= collision_shift)
+         {
+            for (size_t i = 0; i < node.data.size(); ++i)
+            {
+               if (node.data[i].name == member.name)
+               {
+                  node.data[i].value = member.value;
+                  return false;
+               }
+            }
+
+            node.data.push_back(member);
+            return true;
+         }
+
+         const boost::uint32_t bit = 1u << ((member.hash >> shift) & level_mask);
+         if (node.datamap & bit)
+         {
+            const size_t i = popcount(node.datamap & (bit - 1));
+            if (node.data[i].hash == member.hash && node.data[i].name == member.name)
+            {
+               node.data[i].value = member.value;
+               return false;
+            }
+
+            // Move the existing member down into a new child along with the new one.
+            hamt_ptr child;
+            hamt_assign(child, shift + bits_per_level, node.data[i]);
+            hamt_assign(child, shift + bits_per_level, member);
+            node.data.erase(node.data.begin() + i);
+            node.datamap &= ~bit;
+            node.nodes.insert(node.nodes.begin() + popcount(node.nodemap & (bit - 1)), child);
+            node.nodemap |= bit;
+            return true;
+         }
+
+         if (node.nodemap & bit)
+         {
+            return hamt_assign(node.nodes[popcount(node.nodemap & (bit - 1))], shift + bits_per_level, member);
+         }
+
+         node.data.insert(node.data.begin() + popcount(node.datamap & (bit - 1)), member);
+         node.datamap |= bit;
+         return true;
+      }
+
+      /// Removes a member known to exist.
+      void hamt_erase(hamt_ptr& slot, unsigned shift, boost::string_ref name, boost::uint32_t hash)
+      {
+         json_persistent_hamt& node = make_unique<json_persistent_hamt>(slot);
+
+         if (shift >= collision_shift)
+         {
+            for (size_t i = 0; i < node.data.size(); ++i)
+            {
+               if (node.data[i].name.get_string_ref() == name)
+               {
+                  node.data.erase(node.data.begin() + i);
+                  break;
+               }
+            }
+         }
+         else
+         {
+            const boost::uint32_t bit = 1u << ((hash >> shift) & level_mask);
+            if (node.datamap & bit)
+            {
+               node.data.erase(node.data.begin() + popcount(node.datamap & (bit - 1)));
+               node.datamap &= ~bit;
+            }
+            else
+            {
+               const size_t n = popcount(node.nodemap & (bit - 1));
+               hamt_erase(node.nodes[n], shift + bits_per_level, name, hash);
+
+               const json_persistent_hamt* child = node.nodes[n].get();
+               if (!child || (child->nodes.empty() && child->data.size() == 1))
+               {
+                  if (child)
+                  {
+                     // Fold the last member of the child into this node.
+                     node.data.insert(node.data.begin() + popcount(node.datamap & (bit - 1)), child->data.front());
+                     node.datamap |= bit;
+                  }
+
+                  node.nodes.erase(node.nodes.begin() + n);
+                  node.nodemap &= ~bit;
+               }
+            }
+         }
+
+         if (node.data.empty() && node.nodes.empty())
+         {
+            slot.reset();
+         }
+      }
+
+      bool hamt_equal(const json_persistent_hamt* lhs, const json_persistent_hamt* rhs, unsigned shift)
+      {
+         if (lhs == rhs)
+            return true;
+
+         if (!lhs || !rhs)
+            return false;
+
+         if (shift >= collision_shift)
+         {
+            if (lhs->data.size() != rhs->data.size())
+               return false;
+
+            for (size_t i = 0; i < lhs->data.size(); ++i)
+            {
+               const json_persistent_member* other = hamt_find(rhs, lhs->data[i].name.get_string_ref(), lhs->data[i].hash);
+               if (!other || other->value != lhs->data[i].value)
+                  return false;
+            }
+
+            return true;
+         }
+
+         if (lhs->datamap != rhs->datamap || lhs->nodemap != rhs->nodemap)
+            return false;
+
+         for (size_t i = 0; i < lhs->data.size(); ++i)
+         {
+            if (lhs->data[i].name != rhs->data[i].name || lhs->data[i].value != rhs->data[i].value)
+               return false;
+         }
+
+         for (size_t i = 0; i < lhs->nodes.size(); ++i)
+         {
+            if (!hamt_equal(lhs->nodes[i].get(), rhs->nodes[i].get(), shift + bits_per_level))
+               return false;
+         }
+
+         return true;
+      }
+   }
+
+   const json_persistent_value json_persistent_value::null;
+
+   json_persistent_value::json_persistent_value(const json_array& /*val*/)
+   {
+      detail::json_persistent_node* n = new detail::json_persistent_array();
+      intrusive_ptr_add_ref(n);
+      st.set_pointer(detail::variant_type_array, n);
+   }
+
+   json_persistent_value::json_persistent_value(const json_object& /*val*/)
+   {
+      detail::json_persistent_node* n = new detail::json_persistent_object();
+      intrusive_ptr_add_ref(n);
+      st.set_pointer(detail::variant_type_object, n);
+   }
+
+   void json_persistent_value::init_string(const char* str, size_t length)
+   {
+      if (!st.set_short_string(str, length))
+      {
+         detail::json_persistent_node* n = new detail::json_persistent_string(str, length);
+         intrusive_ptr_add_ref(n);
+         st.set_pointer(detail::variant_type_string, n);
+      }
+   }
+
+   bool json_persistent_value::operator==(const json_persistent_value& rhs) const
+   {
+      if (st.type() != rhs.st.type())
+         return false;
+
+      if (st.has_pointer() && rhs.st.has_pointer() && st.pointer() == rhs.st.pointer())
+         return true;
+
+      switch (st.type())
+      {
+      case detail::variant_type_null:
+         return true;
+      case detail::variant_type_string:
+         return get_string_ref() == rhs.get_string_ref();
+      case detail::variant_type_number:
+         return (detail::json_isnan(st.number()) && detail::json_isnan(rhs.st.number())) || st.number() == rhs.st.number();
+      case detail::variant_type_bool:
+         return st.boolean() == rhs.st.boolean();
+      case detail::variant_type_array:
+         return array().size == rhs.array().size && vector_equal(array().root.get(), rhs.array().root.get(), array().shift);
+      case detail::variant_type_object:
+         return object().size == rhs.object().size && hamt_equal(object().root.get(), rhs.object().root.get(), 0);
+      default:
+         return true;
+      }
+   }
+
+   boost::string_ref json_persistent_value::get_string_ref() const
+   {
+      assert(is_string());
+      if (!is_string())
+         return boost::string_ref();
+
+      if (st.has_pointer())
+         return boost::string_ref(static_cast<const detail::json_persistent_string*>(node())->str);
+
+      return st.short_string();
+   }
+
+   const detail::json_persistent_array& json_persistent_value::array() const
+   {
+      return *static_cast<const detail::json_persistent_array*>(node());
+   }
+
+   const detail::json_persistent_object& json_persistent_value::object() const
+   {
+      return *static_cast<const detail::json_persistent_object*>(node());
+   }
+
+   detail::json_persistent_array& json_persistent_value::mutable_array()
+   {
+      if (!is_array())
+      {
+         json_persistent_value(json_array()).swap(*this);
+      }
+      else if (!node()->unique())
+      {
+         detail::json_persistent_node* n = new detail::json_persistent_array(array());
+         intrusive_ptr_add_ref(n);
+         intrusive_ptr_release(node());
+         st.set_pointer(detail::variant_type_array, n);
+      }
+
+      return *static_cast<detail::json_persistent_array*>(node());
+   }
+
+   detail::json_persistent_object& json_persistent_value::mutable_object()
+   {
+      if (!is_object())
+      {
+         json_persistent_value(json_object()).swap(*this);
+      }
+      else if (!node()->unique())
+      {
+         detail::json_persistent_node* n = new detail::json_persistent_object(object());
+         intrusive_ptr_add_ref(n);
+         intrusive_ptr_release(node());
+         st.set_pointer(detail::variant_type_object, n);
+      }
+
+      return *static_cast<detail::json_persistent_object*>(node());
+   }
+
+   const json_persistent_value& json_persistent_value::get_child(size_t i) const
+   {
+      assert(is_null() || is_array());
+      if (!is_array() || i >= array().size)
+      {
+         return null;
+      }
+
+      return vector_get(array().root.get(), array().shift, i);
+   }
+
+   size_t json_persistent_value::get_length() const
+   {
+      return is_array() ? array().size : 0;
+   }
+
+   void json_persistent_value::assign_element(size_t i, const json_persistent_value& val)
+   {
+      assert(is_null() || is_array());
+      while (get_length() < i)
+      {
+         push_back(null);
+      }
+
+      if (i == get_length())
+      {
+         push_back(val);
+         return;
+      }
+
+      detail::json_persistent_array& a = mutable_array();
+      vector_assign(a.root, a.shift, i, val);
+   }
+
+   void json_persistent_value::push_back(const json_persistent_value& val)
+   {
+      detail::json_persistent_array& a = mutable_array();
+      if (a.root && a.size == static_cast<size_t>(branch_factor) << a.shift)
+      {
+         // The tree is full, add a level on top.
+         json_persistent_branch* top = new json_persistent_branch();
+         top->children.push_back(a.root);
+         a.root.reset(top);
+         a.shift += bits_per_level;
+      }
+
+      vector_push(a.root, a.shift, a.size, val);
+      ++a.size;
+   }
+
+   void json_persistent_value::pop_back()
+   {
+      detail::json_persistent_array& a = mutable_array();
+      assert(a.size != 0);
+      vector_pop(a.root, a.shift, --a.size);
+
+      // Remove levels with a single child.
+      while (a.shift > 0 && static_cast<const json_persistent_branch*>(a.root.get())->children.size() == 1)
+      {
+         const node_ptr child = static_cast<const json_persistent_branch*>(a.root.get())->children.front();
+         a.root = child;
+         a.shift -= bits_per_level;
+      }
+
+      if (a.size == 0)
+      {
+         a.root.reset();
+         a.shift = 0;
+      }
+   }
+
+   json_persistent_value json_persistent_value::with_element(size_t i, const json_persistent_value& val) const
+   {
+      json_persistent_value result(*this);
+      result.assign_element(i, val);
+      return result;
+   }
+
+   json_persistent_value json_persistent_value::with_appended(const json_persistent_value& val) const
+   {
+      assert(is_null() || is_array());
+      json_persistent_value result(*this);
+      result.push_back(val);
+      return result;
+   }
+
+   json_persistent_value json_persistent_value::with_length(size_t length) const
+   {
+      assert(is_null() || is_array());
+      json_persistent_value result(*this);
+      result.mutable_array();
+      while (result.get_length() > length)
+      {
+         result.pop_back();
+      }
+
+      while (result.get_length() < length)
+      {
+         result.push_back(null);
+      }
+
+      return result;
+   }
+
+   const json_persistent_value& json_persistent_value::get_child(boost::string_ref name) const
+   {
+      assert(is_null() || is_object());
+      const json_persistent_value* child = find_child(name);
+      return child ? *child : null;
+   }
+
+   const json_persistent_value* json_persistent_value::find_child(boost::string_ref name) const
+   {
+      if (!is_object())
+      {
+         return 0;
+      }
+
+      const json_persistent_member* member = hamt_find(object().root.get(), name, detail::json_hash_name(name));
+      return member ? &member->value : 0;
+   }
+
+   const json_persistent_value& json_persistent_value::get_child(const json_key& key) const
+   {
+      assert(is_null() || is_object());
+      const json_persistent_value* child = find_child(key);
+      return child ? *child : null;
+   }
+
+   const json_persistent_value* json_persistent_value::find_child(const json_key& key) const
+   {
+      if (!is_object())
+      {
+         return 0;
+      }
+
+      const json_persistent_member* member = hamt_find(object().root.get(), key.get_name(), key.get_hash());
+      return member ? &member->value : 0;
+   }
+
+   void json_persistent_value::get_children(const json_key_set& keys, const json_persistent_value** children) const
+   {
+      assert(is_null() || is_object());
+      for (size_t k = 0; k != keys.size(); ++k)
+      {
+         const json_persistent_value* child = find_child(keys.get_key(k));
+         children[k] = child ? child : &null;
+      }
+   }
+
+   void json_persistent_value::assign_child(boost::string_ref name, const json_persistent_value& val)
+   {
+      assert(is_null() || is_object());
+      json_persistent_member member;
+      member.name.init_string(name.data(), name.size());
+      member.hash = detail::json_hash_name(name);
+      member.value = val;
+
+      detail::json_persistent_object& o = mutable_object();
+      if (hamt_assign(o.root, 0, member))
+      {
+         ++o.size;
+      }
+   }
+
+   bool json_persistent_value::erase_child(boost::string_ref name)
+   {
+      assert(is_null() || is_object());
+      if (!is_object())
+      {
+         return false;
+      }
+
+      const boost::uint32_t hash = detail::json_hash_name(name);
+      if (!hamt_find(object().root.get(), name, hash))
+      {
+         return false;
+      }
+
+      detail::json_persistent_object& o = mutable_object();
+      hamt_erase(o.root, 0, name, hash);
+      --o.size;
+      return true;
+   }
+
+   json_persistent_value json_persistent_value::with_child(boost::string_ref name, const json_persistent_value& val) const
+   {
+      json_persistent_value result(*this);
+      result.assign_child(name, val);
+      return result;
+   }
+
+   json_persistent_value json_persistent_value::without_child(boost::string_ref name) const
+   {
+      json_persistent_value result(*this);
+      result.erase_child(name);
+      return result;
+   }
+
+   std::string json_persistent_value::to_pretty_string(size_t indent_size) const
+   {
+      json_buffer buffer;
+      json_buffer_pretty_printer writer(buffer, indent_size);
+      accept(writer);
+      std::string str;
+      buffer.release(str);
+      return str;
+   }
+
+   std::string json_persistent_value::to_string() const
+   {
+      json_buffer buffer;
+      json_buffer_writer writer(buffer);
+      accept(writer);
+      std::string str;
+      buffer.release(str);
+      return str;
+   }
+
+   void json_persistent_builder::end_value()
+   {
+      json_persistent_value& parent = s.back();
+      if (parent.is_object())
+      {
+         parent.assign_child(keys.back(), current);
+         keys.pop_back();
+      }
+      else
+      {
+         parent.push_back(current);
+      }
+
+      current = json_persistent_value();
+   }
+
+   std::ostream& operator<<(std::ostream& os, const json_persistent_value& rhs)
+   {
+      json_buffer buffer(os);
+      json_buffer_writer writer(buffer);
+      rhs.accept(writer);
+      buffer.flush();
+      return os;
+   }
+}
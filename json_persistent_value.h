@@ -0,0 +1,613 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_PERSISTENT_VALUE_H)
+#define ADHD_JSON_PERSISTENT_VALUE_H
+
+#include "json_value.h"
+#include <boost/intrusive_ptr.hpp>
+#include <vector>
+
+namespace adhd
+{
+   namespace detail
+   {
+      /// Reference counted, polymorphic node of a json_persistent_value.
+      struct ADHD_JSON_API json_persistent_node
+      {
+         json_persistent_node()
+            : refs(0)
+         {
+         }
+
+         virtual ~json_persistent_node();
+
+         bool unique() const
+         {
+            return refs.load(boost::memory_order_acquire) == 1;
+         }
+
+         mutable boost::atomic<unsigned> refs;
+
+      private:
+         json_persistent_node(const json_persistent_node&);
+         json_persistent_node& operator=(const json_persistent_node&);
+      };
+
+      inline void intrusive_ptr_add_ref(const json_persistent_node* node)
+      {
+         node->refs.fetch_add(1, boost::memory_order_relaxed);
+      }
+
+      inline void intrusive_ptr_release(const json_persistent_node* node)
+      {
+         if (node->refs.fetch_sub(1, boost::memory_order_release) == 1)
+         {
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            delete node;
+         }
+      }
+
+      struct json_persistent_array;
+      struct json_persistent_object;
+      struct json_persistent_hamt;
+   }
+
+   /// Immutable JSON value with structural sharing, for keeping many
+   /// versions of a document. The with_ and without_ functions return a new
+   /// value which shares every unchanged subtree with the old one, so
+   /// storing N versions costs memory proportional to the changes between
+   /// them rather than N times the document size.
+   ///
+   /// Arrays are 32-way radix trees and objects are hash array mapped tries
+   /// (HAMT), giving O(log32 n) lookups and updates. Nodes are never
+   /// modified once shared and reference counts are atomic, so values can be
+   /// read from any number of threads without locking.
+   ///
+   /// Object members are visited in hash order.
+   class ADHD_JSON_API json_persistent_value
+   {
+   public:
+      json_persistent_value()
+         : st()
+      {
+      }
+
+      json_persistent_value(const json_null& /*val*/)
+         : st()
+      {
+      }
+
+      json_persistent_value(const json_string& val)
+      {
+         init_string(val.val.data(), val.val.size());
+      }
+
+      explicit json_persistent_value(const std::string& val)
+      {
+         init_string(val.data(), val.size());
+      }
+
+      json_persistent_value(const json_number& val)
+      {
+         st.set_number(val.val);
+      }
+
+      explicit json_persistent_value(double val)
+      {
+         st.set_number(val);
+      }
+
+      template <class T>
+      explicit json_persistent_value(T, typename boost::enable_if< boost::is_same<T, bool> >::type* = 0)
+      {
+         // prevent direct initialization from bool, use the json_persistent_value(json_bool) constructor instead.
+         BOOST_STATIC_ASSERT(sizeof(T) == 0);
+      }
+
+      json_persistent_value(const json_bool& val)
+      {
+         st.set_bool(val.val);
+      }
+
+      json_persistent_value(const json_array& val);
+
+      json_persistent_value(const json_object& val);
+
+      /// Converts a mutable JSON value.
+      template <typename TLayout, typename TObjects, typename TAllocator>
+      explicit json_persistent_value(const basic_json_value<TLayout, TObjects, TAllocator>& val);
+
+      json_persistent_value(const json_persistent_value& rhs)
+         : st(rhs.st)
+      {
+         if (st.has_pointer())
+            intrusive_ptr_add_ref(node());
+      }
+
+      json_persistent_value& operator=(json_persistent_value rhs)
+      {
+         swap(rhs);
+         return *this;
+      }
+
+      ~json_persistent_value()
+      {
+         if (st.has_pointer())
+            intrusive_ptr_release(node());
+      }
+
+      void swap(json_persistent_value& rhs)
+      {
+         std::swap(st, rhs.st);
+      }
+
+      /// Recursively visits the visitor.
+      template <typename TVisitor>
+      void accept(TVisitor& visitor) const;
+
+      bool operator==(const json_persistent_value& rhs) const;
+
+      bool operator!=(const json_persistent_value& rhs) const
+      {
+         return !(*this == rhs);
+      }
+
+      bool is_null() const
+      {
+         return st.type() == detail::variant_type_null;
+      }
+
+      bool is_string() const
+      {
+         return st.type() == detail::variant_type_string;
+      }
+
+      std::string get_string() const
+      {
+         const boost::string_ref str = get_string_ref();
+         return std::string(str.data(), str.size());
+      }
+
+      boost::string_ref get_string_ref() const;
+
+      bool is_number() const
+      {
+         return st.type() == detail::variant_type_number;
+      }
+
+      double get_number() const
+      {
+         assert(is_number());
+         return is_number() ? st.number() : 0;
+      }
+
+      bool is_bool() const
+      {
+         return st.type() == detail::variant_type_bool;
+      }
+
+      bool get_bool() const
+      {
+         assert(is_bool());
+         return is_bool() ? st.boolean() : false;
+      }
+
+      bool is_array() const
+      {
+         return st.type() == detail::variant_type_array;
+      }
+
+      const json_persistent_value& get_child(size_t i) const;
+
+      size_t get_length() const;
+
+      /// Returns a copy with element i replaced, padding with nulls if i is
+      /// past the end. Null values become arrays.
+      json_persistent_value with_element(size_t i, const json_persistent_value& val) const;
+
+      /// Returns a copy with val appended.
+      json_persistent_value with_appended(const json_persistent_value& val) const;
+
+      /// Returns a copy truncated or padded with nulls to the given length.
+      json_persistent_value with_length(size_t length) const;
+
+      bool is_object() const
+      {
+         return st.type() == detail::variant_type_object;
+      }
+
+      const json_persistent_value& get_child(boost::string_ref name) const;
+
+      /// Returns the named member, or null if there is no such member.
+      const json_persistent_value* find_child(boost::string_ref name) const;
+
+      bool has_child(boost::string_ref name) const
+      {
+         return find_child(name) != 0;
+      }
+
+      /// Lookups by a json_key reuse the hash of the name.
+      const json_persistent_value& get_child(const json_key& key) const;
+
+      const json_persistent_value* find_child(const json_key& key) const;
+
+      bool has_child(const json_key& key) const
+      {
+         return find_child(key) != 0;
+      }
+
+      /// Looks up every key of keys, storing the member, or a reference to
+      /// null if there is no such member, in children[key number].
+      void get_children(const json_key_set& keys, const json_persistent_value** children) const;
+
+      /// Returns a copy with the named member set to val. Null values become objects.
+      json_persistent_value with_child(boost::string_ref name, const json_persistent_value& val) const;
+
+      /// Returns a copy without the named member.
+      json_persistent_value without_child(boost::string_ref name) const;
+
+      std::string to_pretty_string(size_t indent_size = 4) const;
+
+      std::string to_string() const;
+
+      /// Public static for representing a null JSON value.
+      static const json_persistent_value null;
+
+   private:
+      friend struct json_persistent_builder;
+
+      void init_string(const char* str, size_t length);
+
+      detail::json_persistent_node* node() const
+      {
+         return static_cast<detail::json_persistent_node*>(st.pointer());
+      }
+
+      const detail::json_persistent_array& array() const;
+
+      const detail::json_persistent_object& object() const;
+
+      detail::json_persistent_array& mutable_array();
+
+      detail::json_persistent_object& mutable_object();
+
+      // In-place updates, copying only nodes which are shared.
+      void assign_element(size_t i, const json_persistent_value& val);
+      void push_back(const json_persistent_value& val);
+      void pop_back();
+      void assign_child(boost::string_ref name, const json_persistent_value& val);
+      bool erase_child(boost::string_ref name);
+
+      template <typename TVisitor>
+      static void accept_elements(const detail::json_persistent_node* node, unsigned shift, TVisitor& visitor);
+
+      template <typename TVisitor>
+      static void accept_members(const detail::json_persistent_hamt* node, TVisitor& visitor);
+
+      json_tagged_layout::storage st;
+   };
+
+   namespace detail
+   {
+      struct ADHD_JSON_API json_persistent_string : json_persistent_node
+      {
+         json_persistent_string(const char* str, size_t length)
+            : str(str, length)
+         {
+         }
+
+         virtual ~json_persistent_string();
+
+         const std::string str;
+      };
+
+      /// Bottom level node of the radix tree of an array, up to 32 values.
+      struct ADHD_JSON_API json_persistent_leaf : json_persistent_node
+      {
+         json_persistent_leaf()
+         {
+         }
+
+         json_persistent_leaf(const json_persistent_leaf& rhs)
+            : json_persistent_node()
+            , items(rhs.items)
+         {
+         }
+
+         virtual ~json_persistent_leaf();
+
+         std::vector<json_persistent_value> items;
+      };
+
+      /// Inner node of the radix tree of an array, up to 32 children.
+      struct ADHD_JSON_API json_persistent_branch : json_persistent_node
+      {
+         json_persistent_branch()
+         {
+         }
+
+         json_persistent_branch(const json_persistent_branch& rhs)
+            : json_persistent_node()
+            , children(rhs.children)
+         {
+         }
+
+         virtual ~json_persistent_branch();
+
+         std::vector< boost::intrusive_ptr<json_persistent_node> > children;
+      };
+
+      /// Array payload. The tree has leaves at shift 0 and one level of
+      /// branches per 5 bits of shift above that.
+      struct ADHD_JSON_API json_persistent_array : json_persistent_node
+      {
+         json_persistent_array()
+            : size(0)
+            , shift(0)
+         {
+         }
+
+         json_persistent_array(const json_persistent_array& rhs)
+            : json_persistent_node()
+            , size(rhs.size)
+            , shift(rhs.shift)
+            , root(rhs.root)
+         {
+         }
+
+         virtual ~json_persistent_array();
+
+         size_t size;
+         unsigned shift;
+         boost::intrusive_ptr<json_persistent_node> root;
+      };
+
+      struct json_persistent_member
+      {
+         json_persistent_value name;
+         boost::uint32_t hash;
+         json_persistent_value value;
+      };
+
+      /// Node of a hash array mapped trie. Each 5 bits of the name hash
+      /// select a slot which holds either a member (datamap) or a child node
+      /// (nodemap). Nodes below the last hash bits hold colliding members in
+      /// a plain list. Nodes are kept compact, a child with a single member
+      /// is folded into its parent, so equal objects have equal tries.
+      struct ADHD_JSON_API json_persistent_hamt : json_persistent_node
+      {
+         json_persistent_hamt()
+            : datamap(0)
+            , nodemap(0)
+         {
+         }
+
+         json_persistent_hamt(const json_persistent_hamt& rhs)
+            : json_persistent_node()
+            , datamap(rhs.datamap)
+            , nodemap(rhs.nodemap)
+            , data(rhs.data)
+            , nodes(rhs.nodes)
+         {
+         }
+
+         virtual ~json_persistent_hamt();
+
+         boost::uint32_t datamap;
+         boost::uint32_t nodemap;
+         std::vector<json_persistent_member> data;
+         std::vector< boost::intrusive_ptr<json_persistent_hamt> > nodes;
+      };
+
+      /// Object payload.
+      struct ADHD_JSON_API json_persistent_object : json_persistent_node
+      {
+         json_persistent_object()
+            : size(0)
+         {
+         }
+
+         json_persistent_object(const json_persistent_object& rhs)
+            : json_persistent_node()
+            , size(rhs.size)
+            , root(rhs.root)
+         {
+         }
+
+         virtual ~json_persistent_object();
+
+         size_t size;
+         boost::intrusive_ptr<json_persistent_hamt> root;
+      };
+   }
+
+   /// Visitor for building a persistent JSON value, see basic_json_builder.
+   /// Containers are completed before they are attached to their parent,
+   /// so they are updated in place.
+   struct ADHD_JSON_API json_persistent_builder
+   {
+      json_persistent_value& root;
+      std::vector<json_persistent_value> s;
+      std::vector<std::string> keys;
+      json_persistent_value current;
+      bool in_key;
+
+      explicit json_persistent_builder(json_persistent_value& root)
+         : root(root)
+         , in_key(false)
+      {
+      }
+
+      void null_value()
+      {
+         set(json_persistent_value());
+      }
+
+      void string_value(const std::string& val)
+      {
+         if (in_key)
+            keys.push_back(val);
+         else
+            set(json_persistent_value(val));
+      }
+
+      void number_value(double val)
+      {
+         set(json_persistent_value(val));
+      }
+
+      void bool_value(bool val)
+      {
+         set(json_bool(val));
+      }
+
+      void begin_array()
+      {
+         s.push_back(json_array());
+      }
+
+      void end_array()
+      {
+         end_container();
+      }
+
+      void begin_object()
+      {
+         s.push_back(json_object());
+      }
+
+      void end_object()
+      {
+         end_container();
+      }
+
+      void begin_key()
+      {
+         in_key = true;
+      }
+
+      void end_key()
+      {
+         in_key = false;
+      }
+
+      void begin_value()
+      {
+      }
+
+      void end_value();
+
+   private:
+      void set(const json_persistent_value& val)
+      {
+         current = val;
+         if (s.empty())
+            root = current;
+      }
+
+      void end_container()
+      {
+         current.swap(s.back());
+         s.pop_back();
+         if (s.empty())
+            root = current;
+      }
+   };
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   json_persistent_value::json_persistent_value(const basic_json_value<TLayout, TObjects, TAllocator>& val)
+      : st()
+   {
+      json_persistent_builder builder(*this);
+      val.accept(builder);
+   }
+
+   template <typename TVisitor>
+   void json_persistent_value::accept(TVisitor& visitor) const
+   {
+      switch (st.type())
+      {
+      case detail::variant_type_null:
+         visitor.null_value();
+         break;
+      case detail::variant_type_string:
+         visitor.string_value(get_string());
+         break;
+      case detail::variant_type_number:
+         visitor.number_value(st.number());
+         break;
+      case detail::variant_type_bool:
+         visitor.bool_value(st.boolean());
+         break;
+      case detail::variant_type_array:
+         visitor.begin_array();
+         accept_elements(array().root.get(), array().shift, visitor);
+         visitor.end_array();
+         break;
+      case detail::variant_type_object:
+         visitor.begin_object();
+         accept_members(object().root.get(), visitor);
+         visitor.end_object();
+         break;
+      default:
+         break;
+      }
+   }
+
+   template <typename TVisitor>
+   void json_persistent_value::accept_elements(const detail::json_persistent_node* node, unsigned shift, TVisitor& visitor)
+   {
+      if (!node)
+         return;
+
+      if (shift == 0)
+      {
+         const std::vector<json_persistent_value>& items = static_cast<const detail::json_persistent_leaf*>(node)->items;
+         for (std::vector<json_persistent_value>::const_iterator i = items.begin(), e = items.end(); i != e; ++i)
+         {
+            visitor.begin_value();
+            i->accept(visitor);
+            visitor.end_value();
+         }
+      }
+      else
+      {
+         const std::vector< boost::intrusive_ptr<detail::json_persistent_node> >& children = static_cast<const detail::json_persistent_branch*>(node)->children;
+         for (size_t i = 0; i < children.size(); ++i)
+         {
+            accept_elements(children[i].get(), shift - 5, visitor);
+         }
+      }
+   }
+
+   template <typename TVisitor>
+   void json_persistent_value::accept_members(const detail::json_persistent_hamt* node, TVisitor& visitor)
+   {
+      if (!node)
+         return;
+
+      for (std::vector<detail::json_persistent_member>::const_iterator i = node->data.begin(), e = node->data.end(); i != e; ++i)
+      {
+         visitor.begin_key();
+         i->name.accept(visitor);
+         visitor.end_key();
+         visitor.begin_value();
+         i->value.accept(visitor);
+         visitor.end_value();
+      }
+
+      for (size_t i = 0; i < node->nodes.size(); ++i)
+      {
+         accept_members(node->nodes[i].get(), visitor);
+      }
+   }
+
+   /// Outputs a persistent JSON value to a stream in a compact way.
+   ADHD_JSON_API std::ostream& operator<<(std::ostream& os, const json_persistent_value& rhs);
+}
+
+#endif
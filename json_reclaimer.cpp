@@ -0,0 +1,30 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "json_reclaimer.h"
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
+namespace adhd
+{
+   namespace detail
+   {
+      void json_lower_thread_priority()
+      {
+#if defined(_WIN32)
+         SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(SCHED_IDLE)
+         sched_param param = sched_param();
+         pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+      }
+   }
+}
@@ -0,0 +1,206 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_RECLAIMER_H)
+#define ADHD_JSON_RECLAIMER_H
+
+#include "json_value.h"
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/bind/bind.hpp>
+#include <deque>
+#include <vector>
+
+namespace adhd
+{
+   namespace detail
+   {
+      /// Lowers the scheduling priority of the calling thread as far as
+      /// the platform allows without privileges.
+      ADHD_JSON_API void json_lower_thread_priority();
+   }
+
+   /// Frees JSON values on a background thread, so that threads dropping
+   /// large documents do not pay for freeing them. dispose() detaches the
+   /// tree from a value in O(1) and queues it. A low priority thread tears
+   /// the queued trees down iteratively, node by node, so deep trees cannot
+   /// overflow its stack. Values sharing nodes with a queued tree are not
+   /// affected, shared nodes are merely released.
+   ///
+   /// The queue is bounded. try_dispose() refuses to queue a value when the
+   /// queue is full, leaving the value with the caller, while dispose()
+   /// waits for room. Pending values are freed before the destructor
+   /// returns.
+   template <typename TValue>
+   class basic_json_reclaimer
+   {
+   public:
+      /// Counters describing the work done by a reclaimer.
+      struct statistics
+      {
+         statistics()
+            : queued(0)
+            , peak_queued(0)
+            , disposed(0)
+            , rejected(0)
+            , freed_nodes(0)
+         {
+         }
+
+         /// Values waiting to be freed.
+         size_t queued;
+
+         /// Highest number of values waiting at once.
+         size_t peak_queued;
+
+         /// Values freed.
+         size_t disposed;
+
+         /// Values refused by try_dispose because the queue was full.
+         size_t rejected;
+
+         /// Heap nodes freed: arrays and objects, and the strings, packed
+         /// arrays and raw values held outside of their values. Nodes still
+         /// shared with other values are released but not counted.
+         size_t freed_nodes;
+      };
+
+      explicit basic_json_reclaimer(size_t capacity = 1024)
+         : capacity(capacity != 0 ? capacity : 1)
+         , busy(false)
+         , stopping(false)
+         , worker(boost::bind(&basic_json_reclaimer::run, this))
+      {
+      }
+
+      ~basic_json_reclaimer()
+      {
+         {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            stopping = true;
+         }
+
+         not_empty.notify_one();
+         worker.join();
+      }
+
+      /// Queues the tree of value, leaving value null. Returns false,
+      /// leaving value untouched, if the queue is full.
+      bool try_dispose(TValue& value)
+      {
+         {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (queue.size() >= capacity)
+            {
+               ++stats.rejected;
+               return false;
+            }
+
+            push(value);
+         }
+
+         not_empty.notify_one();
+         return true;
+      }
+
+      /// Queues the tree of value, leaving value null. Waits while the queue is full.
+      void dispose(TValue& value)
+      {
+         {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queue.size() >= capacity)
+               not_full.wait(lock);
+
+            push(value);
+         }
+
+         not_empty.notify_one();
+      }
+
+      /// Waits until every queued value has been freed.
+      void drain()
+      {
+         boost::unique_lock<boost::mutex> lock(mutex);
+         while (!queue.empty() || busy)
+            idle.wait(lock);
+      }
+
+      statistics get_statistics() const
+      {
+         boost::lock_guard<boost::mutex> lock(mutex);
+         statistics result = stats;
+         result.queued = queue.size();
+         return result;
+      }
+
+   private:
+      basic_json_reclaimer(const basic_json_reclaimer&);
+      basic_json_reclaimer& operator=(const basic_json_reclaimer&);
+
+      void push(TValue& value)
+      {
+         queue.push_back(TValue());
+         queue.back().swap(value);
+         if (queue.size() > stats.peak_queued)
+            stats.peak_queued = queue.size();
+      }
+
+      void run()
+      {
+         detail::json_lower_thread_priority();
+
+         std::vector<TValue> pending;
+         boost::unique_lock<boost::mutex> lock(mutex);
+         for (;;)
+         {
+            while (queue.empty() && !stopping)
+               not_empty.wait(lock);
+
+            if (queue.empty())
+               break;
+
+            pending.push_back(TValue());
+            pending.back().swap(queue.front());
+            queue.pop_front();
+            busy = true;
+            not_full.notify_one();
+            lock.unlock();
+
+            size_t freed = 0;
+            while (!pending.empty())
+            {
+               TValue value;
+               value.swap(pending.back());
+               pending.pop_back();
+               if (value.release_shallow(pending))
+                  ++freed;
+            }
+
+            lock.lock();
+            busy = false;
+            ++stats.disposed;
+            stats.freed_nodes += freed;
+            idle.notify_all();
+         }
+      }
+
+      const size_t capacity;
+      std::deque<TValue> queue;
+      statistics stats;
+      bool busy;
+      bool stopping;
+      mutable boost::mutex mutex;
+      boost::condition_variable not_empty;
+      boost::condition_variable not_full;
+      boost::condition_variable idle;
+      boost::thread worker;
+   };
+
+   typedef basic_json_reclaimer<json_value> json_reclaimer;
+}
+
+#endif
@@ -0,0 +1,489 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#include "json_reformatter.h"
+#include "json_value.h"
+
+namespace adhd
+{
+   namespace
+   {
+      bool is_digit(char c)
+      {
+         return c >= '0' && c <= '9';
+      }
+
+      bool is_hex_digit(char c)
+      {
+         return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+      }
+
+      void reformat(std::istream& is, json_reformatter& reformatter)
+      {
+         char chunk[64 * 1024];
+         do
+         {
+            is.read(chunk, sizeof(chunk));
+            reformatter.write(chunk, static_cast<size_t>(is.gcount()));
+         }
+         while (is);
+
+         reformatter.finish();
+      }
+   }
+
+   json_reformatter::json_reformatter(json_buffer& out)
+      : out(out)
+      , pretty(false)
+      , expect(expect_root)
+      , token(token_none)
+      , key(false)
+      , escape(0)
+      , number(number_sign)
+      , literal(0)
+   {
+   }
+
+   json_reformatter::json_reformatter(json_buffer& out, size_t indent_size)
+      : out(out)
+      , pretty(true)
+      , indent(indent_size, ' ')
+      , expect(expect_root)
+      , token(token_none)
+      , key(false)
+      , escape(0)
+      , number(number_sign)
+      , literal(0)
+   {
+   }
+
+   void json_reformatter::write(const char* data, size_t size)
+   {
+      const char* p = data;
+      const char* const end = data + size;
+      while (p != end)
+      {
+         switch (token)
+         {
+         case token_none:
+            p = structural(p, end);
+            break;
+
+         case token_string:
+            p = continue_string(p, end);
+            break;
+
+         case token_number:
+            p = continue_number(p, end);
+            break;
+
+         case token_literal:
+            p = continue_literal(p, end);
+            break;
+         }
+      }
+   }
+
+   void json_reformatter::finish()
+   {
+      if (token != token_none || expect != expect_end)
+      {
+         throw json_parse_exception("unexpected end");
+      }
+   }
+
+   const char* json_reformatter::structural(const char* p, const char* end)
+   {
+      const char c = *p;
+      if (detail::json_isspace(c))
+      {
+         do
+         {
+            ++p;
+         }
+         while (p != end && detail::json_isspace(*p));
+
+         return p;
+      }
+
+      switch (expect)
+      {
+      case expect_root:
+         if (c != '{' && c != '[')
+         {
+            throw json_parse_exception("expected object or array");
+         }
+
+         begin_container(c);
+         break;
+
+      case expect_first_value:
+         if (c == ']')
+         {
+            end_container(c);
+            break;
+         }
+
+         newline();
+         begin_value(c);
+         break;
+
+      case expect_value:
+         begin_value(c);
+         break;
+
+      case expect_first_key:
+      case expect_key:
+         if (c == '}' && expect == expect_first_key)
+         {
+            end_container(c);
+            break;
+         }
+
+         if (c != '"')
+         {
+            throw json_parse_exception("expected string");
+         }
+
+         if (expect == expect_first_key)
+         {
+            newline();
+         }
+
+         json_put(out, c);
+         token = token_string;
+         key = true;
+         break;
+
+      case expect_name_separator:
+         if (c != ':')
+         {
+            throw json_parse_exception("expected name-separator");
+         }
+
+         if (pretty)
+            json_write(out, ": ", 2);
+         else
+            json_put(out, ':');
+
+         expect = expect_value;
+         break;
+
+      case expect_value_separator:
+         if (c == ',')
+         {
+            json_put(out, c);
+            newline();
+            expect = objects.back() ? expect_key : expect_value;
+         }
+         else if (c == (objects.back() ? '}' : ']'))
+         {
+            end_container(c);
+         }
+         else if (objects.back())
+         {
+            throw json_parse_exception("expected value-separator or end-object");
+         }
+         else
+         {
+            throw json_parse_exception("expected value-separator or end-array");
+         }
+         break;
+
+      case expect_end:
+         throw json_parse_exception("expected end");
+      }
+
+      return p + 1;
+   }
+
+   const char* json_reformatter::continue_string(const char* p, const char* end)
+   {
+      for (;;)
+      {
+         if (escape == 0)
+         {
+            // Copy the run of characters needing no attention in one go.
+            const char* e = json_find_escape(p, end);
+            json_write(out, p, e - p);
+            p = e;
+            if (p == end)
+            {
+               return p;
+            }
+
+            const char c = *p++;
+            if (c == '"')
+            {
+               json_put(out, c);
+               end_scalar();
+               return p;
+            }
+
+            if (c != '\\')
+            {
+               throw json_parse_exception("expected char");
+            }
+
+            json_put(out, c);
+            escape = -1;
+         }
+
+         if (p == end)
+         {
+            return p;
+         }
+
+         const char c = *p++;
+         if (escape < 0)
+         {
+            switch (c)
+            {
+            case '"':
+            case '\\':
+            case '/':
+            case 'b':
+            case 'f':
+            case 'n':
+            case 'r':
+            case 't':
+               escape = 0;
+               break;
+
+            case 'u':
+               escape = 4;
+               break;
+
+            default:
+               throw json_parse_exception("expected escape");
+            }
+         }
+         else
+         {
+            if (!is_hex_digit(c))
+            {
+               throw json_parse_exception("expected 4hexdig");
+            }
+
+            --escape;
+         }
+
+         json_put(out, c);
+      }
+   }
+
+   const char* json_reformatter::continue_number(const char* p, const char* end)
+   {
+      const char* first = p;
+      for (; p != end; ++p)
+      {
+         const char c = *p;
+         switch (number)
+         {
+         case number_sign:
+            if (!is_digit(c))
+            {
+               throw json_parse_exception("expected integer");
+            }
+
+            number = c == '0' ? number_zero : number_integer;
+            continue;
+
+         case number_zero:
+         case number_integer:
+         case number_fraction:
+            if (is_digit(c) && number != number_zero)
+            {
+               continue;
+            }
+
+            if (c == '.' && number != number_fraction)
+            {
+               number = number_point;
+               continue;
+            }
+
+            if (c == 'e' || c == 'E')
+            {
+               number = number_exponent;
+               continue;
+            }
+            break;
+
+         case number_point:
+            if (!is_digit(c))
+            {
+               throw json_parse_exception("expected fraction");
+            }
+
+            number = number_fraction;
+            continue;
+
+         case number_exponent:
+            if (c == '-' || c == '+')
+            {
+               number = number_exponent_sign;
+               continue;
+            }
+            // Fall through.
+
+         case number_exponent_sign:
+            if (!is_digit(c))
+            {
+               throw json_parse_exception("expected exponent");
+            }
+
+            number = number_exponent_digits;
+            continue;
+
+         case number_exponent_digits:
+            if (is_digit(c))
+            {
+               continue;
+            }
+            break;
+         }
+
+         // c is the first character after the number.
+         json_write(out, first, p - first);
+         end_scalar();
+         return p;
+      }
+
+      json_write(out, first, p - first);
+      return p;
+   }
+
+   const char* json_reformatter::continue_literal(const char* p, const char* end)
+   {
+      const char* first = p;
+      for (; p != end && *literal != '\0'; ++p, ++literal)
+      {
+         if (*p != *literal)
+         {
+            throw json_parse_exception("expected value");
+         }
+      }
+
+      json_write(out, first, p - first);
+      if (*literal == '\0')
+      {
+         end_scalar();
+      }
+
+      return p;
+   }
+
+   void json_reformatter::begin_value(char c)
+   {
+      switch (c)
+      {
+      case '{':
+      case '[':
+         begin_container(c);
+         return;
+
+      case '"':
+         token = token_string;
+         break;
+
+      case 't':
+         token = token_literal;
+         literal = "rue";
+         break;
+
+      case 'f':
+         token = token_literal;
+         literal = "alse";
+         break;
+
+      case 'n':
+         token = token_literal;
+         literal = "ull";
+         break;
+
+      case '-':
+         token = token_number;
+         number = number_sign;
+         break;
+
+      case '0':
+         token = token_number;
+         number = number_zero;
+         break;
+
+      default:
+         if (!is_digit(c))
+         {
+            throw json_parse_exception("expected value");
+         }
+
+         token = token_number;
+         number = number_integer;
+         break;
+      }
+
+      json_put(out, c);
+      key = false;
+   }
+
+   void json_reformatter::begin_container(char c)
+   {
+      json_put(out, c);
+      objects.push_back(c == '{');
+      expect = c == '{' ? expect_first_key : expect_first_value;
+   }
+
+   void json_reformatter::end_container(char c)
+   {
+      const bool empty = expect == expect_first_key || expect == expect_first_value;
+      objects.pop_back();
+      if (!empty)
+      {
+         newline();
+      }
+
+      json_put(out, c);
+      expect = objects.empty() ? expect_end : expect_value_separator;
+   }
+
+   void json_reformatter::end_scalar()
+   {
+      token = token_none;
+      expect = key ? expect_name_separator : expect_value_separator;
+   }
+
+   void json_reformatter::newline()
+   {
+      if (!pretty)
+      {
+         return;
+      }
+
+      json_put(out, '\n');
+
+      for (size_t i = 0; i < objects.size(); ++i)
+      {
+         json_write(out, indent.data(), indent.size());
+      }
+   }
+
+   void json_minify(std::istream& is, std::ostream& os)
+   {
+      json_buffer buffer(os, 64 * 1024);
+      json_reformatter reformatter(buffer);
+      reformat(is, reformatter);
+      buffer.flush();
+   }
+
+   void json_pretty_print(std::istream& is, std::ostream& os, size_t indent_size)
+   {
+      json_buffer buffer(os, 64 * 1024);
+      json_reformatter reformatter(buffer, indent_size);
+      reformat(is, reformatter);
+      buffer.flush();
+   }
+}
@@ -0,0 +1,124 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_REFORMATTER_H)
+#define ADHD_JSON_REFORMATTER_H
+
+#include "json_writer.h"
+#include <istream>
+#include <vector>
+
+namespace adhd
+{
+   /// Minifies or pretty prints a JSON document without building a
+   /// json_value. The document is given in pieces of any size, which are
+   /// checked against the same grammar json_parser accepts and copied to
+   /// the output with only the whitespace changed: strings and numbers
+   /// are written exactly as they appear in the input, neither decoded
+   /// nor reformatted. Memory is bounded by the nesting depth, so
+   /// documents far larger than memory can be passed through.
+   ///
+   /// The layout matches json_writer, or json_pretty_printer when given an
+   /// indent size. Pairing of escaped UTF-16 surrogates is not checked.
+   class ADHD_JSON_API json_reformatter
+   {
+   public:
+      /// Writes the document without whitespace to out.
+      explicit json_reformatter(json_buffer& out);
+
+      /// Writes the document with newlines and indents of indent_size
+      /// spaces to out.
+      json_reformatter(json_buffer& out, size_t indent_size);
+
+      /// Reformats the next size characters of the document. Throws
+      /// json_parse_exception if they do not continue a valid document.
+      void write(const char* data, size_t size);
+
+      /// Throws json_parse_exception unless the whole document has been
+      /// written. Does not flush out.
+      void finish();
+
+   private:
+      json_reformatter(const json_reformatter&);
+      json_reformatter& operator=(const json_reformatter&);
+
+      /// What the next character outside of a token may be.
+      enum expect_state
+      {
+         expect_root,
+         expect_value,
+         expect_first_value,
+         expect_key,
+         expect_first_key,
+         expect_name_separator,
+         expect_value_separator,
+         expect_end,
+      };
+
+      /// The part of the number grammar reached within a number.
+      enum number_state
+      {
+         number_sign,
+         number_zero,
+         number_integer,
+         number_point,
+         number_fraction,
+         number_exponent,
+         number_exponent_sign,
+         number_exponent_digits,
+      };
+
+      /// The token the last character written belongs to, if any.
+      enum token_state
+      {
+         token_none,
+         token_string,
+         token_number,
+         token_literal,
+      };
+
+      const char* structural(const char* p, const char* end);
+      const char* continue_string(const char* p, const char* end);
+      const char* continue_number(const char* p, const char* end);
+      const char* continue_literal(const char* p, const char* end);
+
+      void begin_value(char c);
+      void begin_container(char c);
+      void end_container(char c);
+      void end_scalar();
+      void newline();
+
+      json_buffer& out;
+      const bool pretty;
+      const std::string indent;
+
+      expect_state expect;
+      token_state token;
+
+      /// True if the string being written is a key.
+      bool key;
+
+      /// Within a string, 0 outside of an escape sequence, -1 after the
+      /// backslash and otherwise the number of hex digits left of \uXXXX.
+      int escape;
+
+      number_state number;
+
+      /// Within a literal, the characters not yet matched.
+      const char* literal;
+
+      /// True for each open object, false for each open array.
+      std::vector<bool> objects;
+   };
+
+   /// Copies the JSON document in is to os without whitespace.
+   ADHD_JSON_API void json_minify(std::istream& is, std::ostream& os);
+
+   /// Copies the JSON document in is to os with newlines and indents.
+   ADHD_JSON_API void json_pretty_print(std::istream& is, std::ostream& os, size_t indent_size = 4);
+}
+
+#endif
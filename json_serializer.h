@@ -0,0 +1,299 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_SERIALIZER_H)
+#define ADHD_JSON_SERIALIZER_H
+
+#include "json_value.h"
+#include <boost/utility/string_ref.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace adhd
+{
+   /// Writes a JSON value in a compact way, as to_string() does, in pieces
+   /// of at most a caller given size. Each call to write() fills the
+   /// caller's buffer and returns, keeping its place in the tree on an
+   /// explicit stack and its place inside a long string, and the next
+   /// call carries on from there. This suits non-blocking sockets, where
+   /// a large document is sent as the socket accepts it, with memory
+   /// bounded by the nesting depth rather than the output size.
+   ///
+   /// The value must not be modified or destroyed until the serializer is
+   /// done with it.
+   template <typename TValue>
+   class basic_json_serializer
+   {
+   public:
+      explicit basic_json_serializer(const TValue& value)
+         : pending_begin(0)
+         , pending_end(0)
+         , in_string(false)
+         , root(&value)
+      {
+      }
+
+      /// Writes the next at most size characters of the output to data,
+      /// returning the number written. Fewer than size characters are
+      /// written only when the output is complete, see done().
+      size_t write(char* data, size_t size)
+      {
+         char* out = data;
+         char* const end = data + size;
+         for (;;)
+         {
+            const size_t n = std::min<size_t>(pending_end - pending_begin, end - out);
+            std::memcpy(out, pending + pending_begin, n);
+            out += n;
+            pending_begin += n;
+            if (pending_begin != pending_end)
+               break;
+
+            pending_begin = pending_end = 0;
+            if (!raw_left.empty())
+            {
+               const size_t length = std::min<size_t>(raw_left.size(), end - out);
+               std::memcpy(out, raw_left.data(), length);
+               out += length;
+               raw_left.remove_prefix(length);
+               if (!raw_left.empty())
+                  break;
+
+               continue;
+            }
+
+            if (in_string)
+            {
+               const char* p = json_write_escaped(out, end, string_left.data(), string_left.data() + string_left.size());
+               string_left.remove_prefix(p - string_left.data());
+               if (string_left.empty())
+               {
+                  pending[pending_end++] = '"';
+                  in_string = false;
+               }
+               else
+               {
+                  // The output is full, or the next escape sequence does not fit.
+                  char* e = pending;
+                  json_write_escaped(e, pending + sizeof(pending), string_left.data(), string_left.data() + 1);
+                  pending_end = e - pending;
+                  string_left.remove_prefix(1);
+               }
+
+               continue;
+            }
+
+            if (!next())
+               break;
+         }
+
+         return out - data;
+      }
+
+      /// True once all of the output has been written.
+      bool done() const
+      {
+         return !root && stack.empty() && !in_string && raw_left.empty() && pending_begin == pending_end;
+      }
+
+   private:
+      basic_json_serializer(const basic_json_serializer&);
+      basic_json_serializer& operator=(const basic_json_serializer&);
+
+      /// Remaining children of an array, packed array or object being written.
+      struct frame
+      {
+         enum kind_type
+         {
+            array_frame,
+            packed_frame,
+            object_frame,
+         };
+
+         frame()
+            : kind(array_frame)
+            , separate(false)
+            , key_written(false)
+            , number(0)
+            , numbers_end(0)
+         {
+         }
+
+         kind_type kind;
+
+         /// True once a child has been written, so the next needs a comma.
+         bool separate;
+
+         /// True when the key of member has been written but not its value.
+         bool key_written;
+
+         typename TValue::const_element_iterator element;
+         typename TValue::const_element_iterator elements_end;
+         typename TValue::const_member_iterator member;
+         typename TValue::const_member_iterator members_end;
+         const double* number;
+         const double* numbers_end;
+      };
+
+      /// Puts the next token into pending, or starts the next string.
+      /// Returns false when there is nothing left to write.
+      bool next()
+      {
+         if (root)
+         {
+            const TValue* value = root;
+            root = 0;
+            begin_value(*value);
+            return true;
+         }
+
+         if (stack.empty())
+            return false;
+
+         // f is not used after begin_value, which may push to the stack.
+         frame& f = stack.back();
+         switch (f.kind)
+         {
+         case frame::array_frame:
+            if (f.element != f.elements_end)
+            {
+               put_separator(f);
+               begin_value(*f.element++);
+               return true;
+            }
+            break;
+         case frame::packed_frame:
+            if (f.number != f.numbers_end)
+            {
+               put_separator(f);
+               put_number(*f.number++);
+               return true;
+            }
+            break;
+         case frame::object_frame:
+            if (f.key_written)
+            {
+               pending[pending_end++] = ':';
+               f.key_written = false;
+               begin_value((f.member++)->second);
+               return true;
+            }
+
+            if (f.member != f.members_end)
+            {
+               put_separator(f);
+               f.key_written = true;
+               begin_string(boost::string_ref(f.member->first.data(), f.member->first.size()));
+               return true;
+            }
+            break;
+         }
+
+         pending[pending_end++] = f.kind == frame::object_frame ? '}' : ']';
+         stack.pop_back();
+         return true;
+      }
+
+      void put_separator(frame& f)
+      {
+         if (f.separate)
+            pending[pending_end++] = ',';
+
+         f.separate = true;
+      }
+
+      void begin_value(const TValue& value)
+      {
+         if (value.is_raw())
+         {
+            raw_left = value.get_raw_text();
+         }
+         else if (value.is_object())
+         {
+            frame f;
+            f.kind = frame::object_frame;
+            f.member = value.members().begin();
+            f.members_end = value.members().end();
+            stack.push_back(f);
+            pending[pending_end++] = '{';
+         }
+         else if (value.is_packed())
+         {
+            frame f;
+            f.kind = frame::packed_frame;
+            f.number = value.get_number_span().begin();
+            f.numbers_end = value.get_number_span().end();
+            stack.push_back(f);
+            pending[pending_end++] = '[';
+         }
+         else if (value.is_array())
+         {
+            frame f;
+            f.element = value.elements().begin();
+            f.elements_end = value.elements().end();
+            stack.push_back(f);
+            pending[pending_end++] = '[';
+         }
+         else if (value.is_string())
+         {
+            begin_string(value.get_string_ref());
+         }
+         else if (value.is_number())
+         {
+            put_number(value.get_number());
+         }
+         else if (value.is_bool())
+         {
+            put_literal(value.get_bool() ? "true" : "false");
+         }
+         else
+         {
+            put_literal("null");
+         }
+      }
+
+      void begin_string(boost::string_ref str)
+      {
+         pending[pending_end++] = '"';
+         string_left = str;
+         in_string = true;
+      }
+
+      void put_number(double d)
+      {
+         json_fixed_buffer buffer(pending + pending_end, sizeof(pending) - pending_end);
+         json_write_number(buffer, d);
+         pending_end += buffer.size;
+      }
+
+      void put_literal(const char* str)
+      {
+         const size_t length = std::strlen(str);
+         std::memcpy(pending + pending_end, str, length);
+         pending_end += length;
+      }
+
+      /// Output of the current token not yet written, in [pending_begin, pending_end).
+      char pending[40];
+      size_t pending_begin;
+      size_t pending_end;
+
+      /// Characters of the string being written not yet escaped, if in_string.
+      boost::string_ref string_left;
+      bool in_string;
+
+      /// Characters of the raw value being written not yet written.
+      boost::string_ref raw_left;
+
+      /// The value, until its first token has been written.
+      const TValue* root;
+      detail::json_stack<frame, 16> stack;
+   };
+
+   typedef basic_json_serializer<json_value> json_serializer;
+}
+
+#endif
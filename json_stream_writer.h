@@ -0,0 +1,181 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_STREAM_WRITER_H)
+#define ADHD_JSON_STREAM_WRITER_H
+
+#include "json_value.h"
+#include <boost/utility/string_ref.hpp>
+#include <assert.h>
+
+namespace adhd
+{
+   /// Writes JSON through calls naming each array, object, key and value
+   /// in order, without building a json_value, so records can be written
+   /// as they are produced with memory bounded by the nesting depth. The
+   /// layout is that of TWriter, a basic_json_writer or
+   /// basic_json_pretty_printer, usually writing to a json_buffer that
+   /// flushes to a stream:
+   ///
+   ///    json_buffer buffer(os);
+   ///    json_stream_writer writer(buffer);
+   ///    writer.begin_object();
+   ///    writer.key("id");
+   ///    writer.value(42);
+   ///    writer.end_object();
+   ///    buffer.flush();
+   ///
+   /// A single value is written, normally an array or an object. Calls
+   /// out of order, such as a value where a key is expected, are caught
+   /// by assertions.
+   template <typename TWriter>
+   class basic_json_stream_writer
+   {
+   public:
+      template <typename TOutput>
+      explicit basic_json_stream_writer(TOutput& out)
+         : writer(out)
+         , written(false)
+      {
+      }
+
+      /// Writes with indents of indent_size spaces, for a
+      /// basic_json_pretty_printer.
+      template <typename TOutput>
+      basic_json_stream_writer(TOutput& out, size_t indent_size)
+         : writer(out, indent_size)
+         , written(false)
+      {
+      }
+
+      void begin_array()
+      {
+         begin_value();
+         writer.begin_array();
+         frames.push_back(array_frame);
+      }
+
+      void end_array()
+      {
+         assert(!frames.empty() && frames.back() == array_frame);
+         frames.pop_back();
+         writer.end_array();
+         end_value();
+      }
+
+      void begin_object()
+      {
+         begin_value();
+         writer.begin_object();
+         frames.push_back(object_key_frame);
+      }
+
+      void end_object()
+      {
+         assert(!frames.empty() && frames.back() == object_key_frame);
+         frames.pop_back();
+         writer.end_object();
+         end_value();
+      }
+
+      /// Writes the key of the next member of an object, to be followed
+      /// by its value.
+      void key(boost::string_ref name)
+      {
+         assert(!frames.empty() && frames.back() == object_key_frame);
+         writer.begin_key();
+         writer.string_value(name.data(), name.size());
+         writer.end_key();
+         frames.back() = object_value_frame;
+      }
+
+      void value(const json_null& /*val*/)
+      {
+         begin_value();
+         writer.null_value();
+         end_value();
+      }
+
+      void value(const json_bool& val)
+      {
+         begin_value();
+         writer.bool_value(val.val);
+         end_value();
+      }
+
+      void value(double val)
+      {
+         begin_value();
+         writer.number_value(val);
+         end_value();
+      }
+
+      template <class T>
+      void value(T, typename boost::enable_if< boost::is_same<T, bool> >::type* = 0)
+      {
+         // prevent writing a bool directly, use value(json_bool) instead.
+         BOOST_STATIC_ASSERT(sizeof(T) == 0);
+      }
+
+      void value(boost::string_ref val)
+      {
+         begin_value();
+         writer.string_value(val.data(), val.size());
+         end_value();
+      }
+
+      /// Writes a whole json_value, for parts of the output already held
+      /// as one.
+      template <typename TLayout, typename TObjects, typename TAllocator>
+      void value(const basic_json_value<TLayout, TObjects, TAllocator>& val)
+      {
+         begin_value();
+         val.accept(writer);
+         end_value();
+      }
+
+      /// True once the value has been written in full.
+      bool done() const
+      {
+         return written && frames.empty();
+      }
+
+   private:
+      basic_json_stream_writer(const basic_json_stream_writer&);
+      basic_json_stream_writer& operator=(const basic_json_stream_writer&);
+
+      /// What an open array or object expects next.
+      enum frame_state
+      {
+         array_frame,
+         object_key_frame,
+         object_value_frame,
+      };
+
+      void begin_value()
+      {
+         assert(frames.empty() ? !written : frames.back() != object_key_frame);
+         written = true;
+         writer.begin_value();
+      }
+
+      void end_value()
+      {
+         writer.end_value();
+         if (!frames.empty() && frames.back() == object_value_frame)
+            frames.back() = object_key_frame;
+      }
+
+      TWriter writer;
+      bool written;
+      detail::json_stack<frame_state, 16> frames;
+   };
+
+   typedef basic_json_stream_writer<json_buffer_writer> json_stream_writer;
+   typedef basic_json_stream_writer<json_buffer_pretty_printer> json_pretty_stream_writer;
+}
+
+#endif
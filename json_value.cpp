@@ -5,559 +5,798 @@
 // http://www.boost.org/LICENSE_1_0.txt)
 
 #include "json_value.h"
+#include "json_parser.h"
 #include <algorithm>
-#include <sstream>
-#include <float.h>
-
-#if defined(_MSC_VER)
-#  include <locale.h>
-#else
-#  include <xlocale.h>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define ADHD_JSON_SSE2
+#  include <emmintrin.h>
+#  if defined(_MSC_VER)
+#     include <intrin.h>
+#  endif
 #endif
 
-namespace
+namespace adhd
 {
-   /// Helper for quoting strings.
-   void json_write_quoted_string(std::ostream& os, const std::string& str)
+   json_parse_exception::~json_parse_exception()
    {
-      static const char* hex = "0123456789abcdef";
-
-      os << '"';
+   }
 
-      const char* begin = str.data();
-      const char* end = begin + str.size();
+   json_buffer::json_buffer()
+      : storage(256, '\0')
+      , first(&storage[0])
+      , cursor(first)
+      , limit(first + storage.size())
+      , flush_to(0)
+      , context(0)
+   {
+   }
 
-      for (const char* p = begin; p != end;)
-      {
-         const char* e = std::find_if(p, end, adhd::json_value::need_escaping());
-         os.write(p, e - p);
-         p = e;
-         if (p != end)
-         {
-            switch (*p)
-            {
-            case '\"':
-               os << "\\\"";
-               break;
-            case '\\':
-               os << "\\\\";
-               break;
-            case '\b':
-               os << "\\b";
-               break;
-            case '\f':
-               os << "\\f";
-               break;
-            case '\n':
-               os << "\\n";
-               break;
-            case '\r':
-               os << "\\r";
-               break;
-            case '\t':
-               os << "\\t";
-               break;
-            default:
-               os << "\\u00" << hex[static_cast<unsigned char>(*p) >> 4] << hex[static_cast<unsigned char>(*p) & 0xfu];
-               break;
-            }
+   json_buffer::json_buffer(flush_function flush, void* context, size_t capacity)
+      : storage(capacity != 0 ? capacity : 1, '\0')
+      , first(&storage[0])
+      , cursor(first)
+      , limit(first + storage.size())
+      , flush_to(flush)
+      , context(context)
+   {
+   }
 
-            ++p;
-         }
-      }
+   json_buffer::json_buffer(std::ostream& os, size_t capacity)
+      : storage(capacity != 0 ? capacity : 1, '\0')
+      , first(&storage[0])
+      , cursor(first)
+      , limit(first + storage.size())
+      , flush_to(&json_buffer::flush_to_stream)
+      , context(&os)
+   {
+   }
 
-      os << '"';
+   void json_buffer::release(std::string& str)
+   {
+      storage.resize(size());
+      str.swap(storage);
+      storage.assign(256, '\0');
+      first = cursor = &storage[0];
+      limit = first + storage.size();
    }
 
-   /// Helper for writing numbers.
-   void json_write_number(std::ostream& os, double d)
+   void json_buffer::flush()
    {
-      switch (_fpclass(d))
+      if (flush_to && cursor != first)
       {
-      default:
-         assert(!"Unknown floating point classification.");
-      case _FPCLASS_SNAN:  // signaling NaN
-      case _FPCLASS_QNAN:  // quiet NaN
-         os << "null";
-         break;
-      case _FPCLASS_NINF:  // negative infinity
-         os << "\"-inf\"";
-         break;
-      case _FPCLASS_PINF:  // positive infinity
-         os << "\"+inf\"";
-         break;
-      case _FPCLASS_ND:    // negative denormal
-      case _FPCLASS_NZ:    // -0
-      case _FPCLASS_PZ:    // +0
-      case _FPCLASS_PD:    // positive denormal
-         os << "0";
-         break;
-      case _FPCLASS_NN:    // negative normal
-      case _FPCLASS_PN:    // positive normal
-         {
-            char buffer[100];
-#if defined(_MSC_VER)
-            struct cached_locale
-            {
-               cached_locale() : c_locale(_create_locale(LC_ALL, "C")) {}
-               ~cached_locale() { _free_locale(c_locale); }
-               const _locale_t c_locale;
-            };
-            static const cached_locale locale_cache;
-            const int ret = _sprintf_s_l(buffer, sizeof(buffer), "%.16g", locale_cache.c_locale, d);
-#else
-            struct cached_locale
-            {
-               cached_locale() : c_locale(newlocale(LC_ALL_MASK, NULL, NULL)) {}
-               ~cached_locale() { freelocale(c_locale); }
-               const locale_t c_locale;
-            };
-            static const cached_locale locale_cache;
-            const int ret = snprintf_l(buffer, sizeof(buffer), locale_cache.c_locale, "%.16g", d);
-#endif
-            for (int i = 0; i < ret; ++i)
-            {
-               os << buffer[i];
-            }
-         }
-         break;
+         const size_t length = size();
+         cursor = first;
+         flush_to(context, first, length);
       }
    }
-}
 
-namespace adhd
-{
-   json_parse_exception::~json_parse_exception()
+   void json_buffer::reserve(size_t length)
    {
+      flush();
+      const size_t used = size();
+      if (length <= storage.size() - used)
+         return;
+
+      storage.resize(flush_to ? length : std::max(storage.size() * 2, used + length));
+      first = &storage[0];
+      cursor = first + used;
+      limit = first + storage.size();
    }
 
-   /// Visitor for streaming a JSON value in a compact way.
-   struct json_writer
+   void json_buffer::flush_to_stream(void* os, const char* data, size_t size)
    {
-      enum skip_state
-      {
-         skip_none,
-         skip_comma,
-      };
+      static_cast<std::ostream*>(os)->write(data, size);
+   }
 
-      std::ostream& os;
-      skip_state skip;
+   namespace
+   {
+      /// Second character of the escape sequence for each character, 'u'
+      /// for \u00XX, or 0 for characters written as is. Matches
+      /// json_value::need_escaping.
+      const char escape_table[256] =
+      {
+         'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+         'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+         0,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+         0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+         0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+         0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\',0,   0,   0,
+         0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+         0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   'u',
+      };
 
-      explicit json_writer(std::ostream& os)
-         : os(os)
-         , skip(skip_comma)
+#if defined(ADHD_JSON_SSE2)
+      /// Index of the lowest set bit of a non-zero mask.
+      inline int lowest_bit(unsigned int mask)
       {
+#  if defined(_MSC_VER)
+         unsigned long index;
+         _BitScanForward(&index, mask);
+         return static_cast<int>(index);
+#  else
+         return __builtin_ctz(mask);
+#  endif
       }
+#endif
 
-      void null_value()
-      {
-         os << "null";
-      }
+      /// Returns the first character in [p, end) that needs escaping, or end.
+      const char* find_escape(const char* p, const char* end)
+      {
+#if defined(ADHD_JSON_SSE2)
+         // Compare 16 characters at a time, control characters being those
+         // for which the unsigned maximum with 0x1f is 0x1f.
+         const __m128i control = _mm_set1_epi8(0x1f);
+         const __m128i quote = _mm_set1_epi8('"');
+         const __m128i backslash = _mm_set1_epi8('\\');
+         const __m128i del = _mm_set1_epi8(0x7f);
+         for (; end - p >= 16; p += 16)
+         {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            const __m128i hits = _mm_or_si128(
+               _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control), _mm_cmpeq_epi8(chunk, quote)),
+               _mm_or_si128(_mm_cmpeq_epi8(chunk, backslash), _mm_cmpeq_epi8(chunk, del)));
+            const unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(hits));
+            if (mask != 0)
+               return p + lowest_bit(mask);
+         }
+#endif
 
-      void string_value(const std::string& val)
-      {
-         json_write_quoted_string(os, val);
+         while (p != end && escape_table[static_cast<unsigned char>(*p)] == 0)
+            ++p;
+         return p;
       }
 
-      void number_value(double val)
+      template <typename TOutput>
+      void write_quoted_string(TOutput& out, const char* str, size_t length)
       {
-         json_write_number(os, val);
-      }
+         static const char* hex = "0123456789abcdef";
 
-      void bool_value(bool val)
-      {
-         os << (val ? "true" : "false");
-      }
+         json_put(out, '"');
 
-      void begin_array()
-      {
-         os << '[';
-         skip = skip_comma;
-      }
+         const char* p = str;
+         const char* end = p + length;
 
-      void end_array()
-      {
-         os << ']';
-         skip = skip_none;
+         while (p != end)
+         {
+            const char* e = find_escape(p, end);
+            if (e != p)
+               json_write(out, p, e - p);
+            if (e == end)
+               break;
+
+            const unsigned char c = static_cast<unsigned char>(*e);
+            const char escape[] = { '\\', escape_table[c], '0', '0', hex[c >> 4], hex[c & 0xfu] };
+            json_write(out, escape, escape[1] == 'u' ? 6 : 2);
+            p = e + 1;
+         }
+
+         json_put(out, '"');
       }
 
-      void begin_object()
+      /// Writes the decimal digits of an integer, returning the length.
+      int write_integer(char* out, boost::uint64_t n)
       {
-         os << '{';
-         skip = skip_comma;
+         static const char pairs[] =
+            "0001020304050607080910111213141516171819"
+            "2021222324252627282930313233343536373839"
+            "4041424344454647484950515253545556575859"
+            "6061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+         char digits[20];
+         char* p = digits + sizeof(digits);
+         while (n >= 100)
+         {
+            const size_t i = static_cast<size_t>(n % 100) * 2;
+            n /= 100;
+            *--p = pairs[i + 1];
+            *--p = pairs[i];
+         }
+         if (n >= 10)
+         {
+            *--p = pairs[n * 2 + 1];
+            *--p = pairs[n * 2];
+         }
+         else
+         {
+            *--p = static_cast<char>('0' + n);
+         }
+
+         const int length = static_cast<int>(digits + sizeof(digits) - p);
+         std::memcpy(out, p, length);
+         return length;
       }
 
-      void end_object()
+      /// Floating point number f * 2^e with a 64-bit significand, as used by the Grisu2
+      /// algorithm from "Printing Floating-Point Numbers Quickly and Accurately with Integers"
+      /// (Loitsch, 2010).
+      struct diy_fp
       {
-         os << '}';
-         skip = skip_none;
-      }
+         diy_fp(boost::uint64_t f, int e) : f(f), e(e) {}
 
-      void begin_key()
+         boost::uint64_t f;
+         int e;
+      };
+
+      /// Subtracts numbers with the same exponent.
+      diy_fp subtract(const diy_fp& x, const diy_fp& y)
       {
-         if (skip == skip_comma)
-            skip = skip_none;
-         else
-            os << ',';
+         assert(x.e == y.e && x.f >= y.f);
+         return diy_fp(x.f - y.f, x.e);
       }
 
-      void end_key()
+      /// Multiplies numbers, keeping the upper half of the 128-bit product rounded.
+      diy_fp multiply(const diy_fp& x, const diy_fp& y)
       {
-         os << ':';
-         skip = skip_comma;
+         const boost::uint64_t mask = 0xffffffffu;
+         const boost::uint64_t a = x.f >> 32, b = x.f & mask;
+         const boost::uint64_t c = y.f >> 32, d = y.f & mask;
+         const boost::uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+         const boost::uint64_t middle = (bd >> 32) + (ad & mask) + (bc & mask) + (static_cast<boost::uint64_t>(1) << 31);
+         return diy_fp(ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64);
       }
 
-      void begin_value()
+      /// Shifts the significand left until the highest bit is set.
+      diy_fp normalize(diy_fp x)
       {
-         if (skip == skip_comma)
-            skip = skip_none;
-         else
-            os << ',';
+         assert(x.f != 0);
+         while ((x.f >> 63) == 0)
+         {
+            x.f <<= 1;
+            --x.e;
+         }
+         return x;
       }
 
-      void end_value()
+      /// Shifts the significand left to the given, smaller or equal, exponent.
+      diy_fp normalize_to(const diy_fp& x, int e)
       {
+         assert(x.e >= e);
+         return diy_fp(x.f << (x.e - e), e);
       }
-   };
 
-   /// Visitor for streaming a JSON value in a pretty way, using newlines and indents.
-   struct json_pretty_printer
-   {
-      enum skip_state
+      /// Exponent range of the scaled numbers, for which the digit generation stays within 64 bits.
+      const int grisu_alpha = -60;
+      const int grisu_gamma = -32;
+
+      /// Normalized power of ten 10^k as f * 2^e.
+      struct cached_power
       {
-         skip_none,
-         skip_comma_xor_newline,
-         skip_comma_and_newline,
+         boost::uint32_t high;
+         boost::uint32_t low;
+         int e;
+         int k;
       };
 
-      std::ostream& os;
-      skip_state skip;
-      int indent_level;
-      const std::string indent;
-
-      json_pretty_printer(std::ostream& os, size_t indent_size)
-         : os(os)
-         , skip(skip_comma_and_newline)
-         , indent_level(0)
-         , indent(indent_size, ' ')
+      /// Returns a power of ten c such that the exponent of w * c is in [grisu_alpha, grisu_gamma]
+      /// for a normalized w with exponent e.
+      const cached_power& get_cached_power(int e)
       {
+         // 10^k for k from -300 to 324 in steps of 8.
+         static const cached_power powers[] =
+         {
+               { 0xAB70FE17, 0xC79AC6CA, -1060, -300 },
+               { 0xFF77B1FC, 0xBEBCDC4F, -1034, -292 },
+               { 0xBE5691EF, 0x416BD60C, -1007, -284 },
+               { 0x8DD01FAD, 0x907FFC3C, -980, -276 },
+               { 0xD3515C28, 0x31559A83, -954, -268 },
+               { 0x9D71AC8F, 0xADA6C9B5, -927, -260 },
+               { 0xEA9C2277, 0x23EE8BCB, -901, -252 },
+               { 0xAECC4991, 0x4078536D, -874, -244 },
+               { 0x823C1279, 0x5DB6CE57, -847, -236 },
+               { 0xC2109436, 0x4DFB5637, -821, -228 },
+               { 0x9096EA6F, 0x3848984F, -794, -220 },
+               { 0xD77485CB, 0x25823AC7, -768, -212 },
+               { 0xA086CFCD, 0x97BF97F4, -741, -204 },
+               { 0xEF340A98, 0x172AACE5, -715, -196 },
+               { 0xB23867FB, 0x2A35B28E, -688, -188 },
+               { 0x84C8D4DF, 0xD2C63F3B, -661, -180 },
+               { 0xC5DD4427, 0x1AD3CDBA, -635, -172 },
+               { 0x936B9FCE, 0xBB25C996, -608, -164 },
+               { 0xDBAC6C24, 0x7D62A584, -582, -156 },
+               { 0xA3AB6658, 0x0D5FDAF6, -555, -148 },
+               { 0xF3E2F893, 0xDEC3F126, -529, -140 },
+               { 0xB5B5ADA8, 0xAAFF80B8, -502, -132 },
+               { 0x87625F05, 0x6C7C4A8B, -475, -124 },
+               { 0xC9BCFF60, 0x34C13053, -449, -116 },
+               { 0x964E858C, 0x91BA2655, -422, -108 },
+               { 0xDFF97724, 0x70297EBD, -396, -100 },
+               { 0xA6DFBD9F, 0xB8E5B88F, -369, -92 },
+               { 0xF8A95FCF, 0x88747D94, -343, -84 },
+               { 0xB9447093, 0x8FA89BCF, -316, -76 },
+               { 0x8A08F0F8, 0xBF0F156B, -289, -68 },
+               { 0xCDB02555, 0x653131B6, -263, -60 },
+               { 0x993FE2C6, 0xD07B7FAC, -236, -52 },
+               { 0xE45C10C4, 0x2A2B3B06, -210, -44 },
+               { 0xAA242499, 0x697392D3, -183, -36 },
+               { 0xFD87B5F2, 0x8300CA0E, -157, -28 },
+               { 0xBCE50864, 0x92111AEB, -130, -20 },
+               { 0x8CBCCC09, 0x6F5088CC, -103, -12 },
+               { 0xD1B71758, 0xE219652C, -77, -4 },
+               { 0x9C400000, 0x00000000, -50, 4 },
+               { 0xE8D4A510, 0x00000000, -24, 12 },
+               { 0xAD78EBC5, 0xAC620000, 3, 20 },
+               { 0x813F3978, 0xF8940984, 30, 28 },
+               { 0xC097CE7B, 0xC90715B3, 56, 36 },
+               { 0x8F7E32CE, 0x7BEA5C70, 83, 44 },
+               { 0xD5D238A4, 0xABE98068, 109, 52 },
+               { 0x9F4F2726, 0x179A2245, 136, 60 },
+               { 0xED63A231, 0xD4C4FB27, 162, 68 },
+               { 0xB0DE6538, 0x8CC8ADA8, 189, 76 },
+               { 0x83C7088E, 0x1AAB65DB, 216, 84 },
+               { 0xC45D1DF9, 0x42711D9A, 242, 92 },
+               { 0x924D692C, 0xA61BE758, 269, 100 },
+               { 0xDA01EE64, 0x1A708DEA, 295, 108 },
+               { 0xA26DA399, 0x9AEF774A, 322, 116 },
+               { 0xF209787B, 0xB47D6B85, 348, 124 },
+               { 0xB454E4A1, 0x79DD1877, 375, 132 },
+               { 0x865B8692, 0x5B9BC5C2, 402, 140 },
+               { 0xC83553C5, 0xC8965D3D, 428, 148 },
+               { 0x952AB45C, 0xFA97A0B3, 455, 156 },
+               { 0xDE469FBD, 0x99A05FE3, 481, 164 },
+               { 0xA59BC234, 0xDB398C25, 508, 172 },
+               { 0xF6C69A72, 0xA3989F5C, 534, 180 },
+               { 0xB7DCBF53, 0x54E9BECE, 561, 188 },
+               { 0x88FCF317, 0xF22241E2, 588, 196 },
+               { 0xCC20CE9B, 0xD35C78A5, 614, 204 },
+               { 0x98165AF3, 0x7B2153DF, 641, 212 },
+               { 0xE2A0B5DC, 0x971F303A, 667, 220 },
+               { 0xA8D9D153, 0x5CE3B396, 694, 228 },
+               { 0xFB9B7CD9, 0xA4A7443C, 720, 236 },
+               { 0xBB764C4C, 0xA7A44410, 747, 244 },
+               { 0x8BAB8EEF, 0xB6409C1A, 774, 252 },
+               { 0xD01FEF10, 0xA657842C, 800, 260 },
+               { 0x9B10A4E5, 0xE9913129, 827, 268 },
+               { 0xE7109BFB, 0xA19C0C9D, 853, 276 },
+               { 0xAC2820D9, 0x623BF429, 880, 284 },
+               { 0x80444B5E, 0x7AA7CF85, 907, 292 },
+               { 0xBF21E440, 0x03ACDD2D, 933, 300 },
+               { 0x8E679C2F, 0x5E44FF8F, 960, 308 },
+               { 0xD433179D, 0x9C8CB841, 986, 316 },
+               { 0x9E19DB92, 0xB4E31BA9, 1013, 324 },
+         };
+
+         // k = ceil((alpha - e - 1) * log10(2)), using 78913 / 2^18 for log10(2).
+         const int f = grisu_alpha - e - 1;
+         const int k = (f * 78913) / (1 << 18) + (f > 0);
+         const int index = (300 + k + 7) / 8;
+         assert(index >= 0 && index < static_cast<int>(sizeof(powers) / sizeof(powers[0])));
+
+         const cached_power& cached = powers[index];
+         assert(grisu_alpha <= cached.e + e + 64 && cached.e + e + 64 <= grisu_gamma);
+         return cached;
+      }
+
+      /// Returns the number of decimal digits in n, and the largest power of ten not larger than n.
+      int find_largest_pow10(boost::uint32_t n, boost::uint32_t& pow10)
+      {
+         int digits = 10;
+         for (pow10 = 1000000000u; pow10 > n && digits > 1; pow10 /= 10)
+            --digits;
+         return digits;
+      }
+
+      /// Moves the last digit towards w while the result stays within the rounding interval.
+      void grisu2_round(char* digits, int length, boost::uint64_t dist, boost::uint64_t delta, boost::uint64_t rest, boost::uint64_t ten_k)
+      {
+         while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist))
+         {
+            --digits[length - 1];
+            rest += ten_k;
+         }
       }
 
-      void newline()
+      /// Generates the shortest digits of a number in [minus, plus] close to w, all scaled into
+      /// the [grisu_alpha, grisu_gamma] exponent range. Returns false if the interval widened
+      /// by two units on each side, which holds the true rounding interval, might hold a
+      /// number with fewer digits, as in Grisu3, so that the digits are not proven shortest.
+      bool grisu2_digit_gen(char* digits, int& length, int& exponent, const diy_fp& minus, const diy_fp& w, const diy_fp& plus)
       {
-         os << '\n';
+         boost::uint64_t delta = subtract(plus, minus).f;
+         boost::uint64_t dist = subtract(plus, w).f;
+         boost::uint64_t unit = 1;
+         bool shortest = true;
+
+         // Split plus into an integral part p1 and a fractional part p2.
+         const int shift = -plus.e;
+         const boost::uint64_t one = static_cast<boost::uint64_t>(1) << shift;
+         boost::uint32_t p1 = static_cast<boost::uint32_t>(plus.f >> shift);
+         boost::uint64_t p2 = plus.f & (one - 1);
 
-         for (int i = 0; i < indent_level; ++i)
+         boost::uint32_t pow10;
+         for (int n = find_largest_pow10(p1, pow10); n > 0; pow10 /= 10)
          {
-            os << indent;
+            digits[length++] = static_cast<char>('0' + p1 / pow10);
+            p1 %= pow10;
+            --n;
+
+            const boost::uint64_t rest = (static_cast<boost::uint64_t>(p1) << shift) + p2;
+            const boost::uint64_t ten_k = static_cast<boost::uint64_t>(pow10) << shift;
+            if (rest <= delta)
+            {
+               exponent += n;
+               grisu2_round(digits, length, dist, delta, rest, ten_k);
+               return shortest;
+            }
+
+            if (rest <= delta + 2 * unit || rest + 2 * unit >= ten_k)
+               shortest = false;
          }
-      }
 
-      void null_value()
-      {
-         os << "null";
-      }
+         int m = 0;
+         for (;;)
+         {
+            p2 *= 10;
+            digits[length++] = static_cast<char>('0' + (p2 >> shift));
+            p2 &= one - 1;
+            ++m;
+            delta *= 10;
+            dist *= 10;
+            unit *= 10;
+            if (p2 <= delta)
+               break;
 
-      void string_value(const std::string& val)
-      {
-         json_write_quoted_string(os, val);
-      }
+            if (p2 <= delta + 2 * unit || p2 + 2 * unit >= one)
+               shortest = false;
+         }
 
-      void number_value(double val)
-      {
-         json_write_number(os, val);
+         exponent -= m;
+         grisu2_round(digits, length, dist, delta, p2, one);
+         return shortest;
       }
 
-      void bool_value(bool val)
+      /// Generates digits that read back as the positive finite double with the given bits,
+      /// such that the value is digits * 10^exponent. Returns false if they are not proven
+      /// shortest, see grisu2_digit_gen.
+      bool grisu2(boost::uint64_t bits, char* digits, int& length, int& exponent)
       {
-         os << (val ? "true" : "false");
+         const boost::uint64_t hidden = static_cast<boost::uint64_t>(1) << 52;
+         const boost::uint64_t fraction = bits & (hidden - 1);
+         const int biased = static_cast<int>(bits >> 52);
+         const diy_fp v = biased == 0 ? diy_fp(fraction, -1074) : diy_fp(fraction + hidden, biased - 1075);
+
+         // The boundaries are halfway to the neighbours, the lower one being closer when
+         // the fraction is zero, except for the smallest normal numbers.
+         const diy_fp plus = normalize(diy_fp(2 * v.f + 1, v.e - 1));
+         const diy_fp minus = normalize_to(fraction == 0 && biased > 1 ? diy_fp(4 * v.f - 1, v.e - 2) : diy_fp(2 * v.f - 1, v.e - 1), plus.e);
+         const diy_fp w = normalize(v);
+         assert(w.e == plus.e);
+
+         const cached_power& cached = get_cached_power(plus.e);
+         const diy_fp c((static_cast<boost::uint64_t>(cached.high) << 32) | cached.low, cached.e);
+         const diy_fp w_minus = multiply(minus, c);
+         const diy_fp w_plus = multiply(plus, c);
+
+         // Shrink the interval by one unit to compensate for the rounding of the products.
+         length = 0;
+         exponent = -cached.k;
+         return grisu2_digit_gen(digits, length, exponent, diy_fp(w_minus.f + 1, w_minus.e), multiply(w, c), diy_fp(w_plus.f - 1, w_plus.e));
       }
 
-      void begin_array()
+      /// True if digits * 10^exponent reads back as d. The text has no decimal point, so
+      /// strtod reads it the same in every locale.
+      bool reads_back(const char* digits, int length, int exponent, double d)
       {
-         os << '[';
-         skip = skip_comma_xor_newline;
-         ++indent_level;
+         char text[32];
+         std::memcpy(text, digits, length);
+         char* out = text + length;
+         *out++ = 'e';
+         if (exponent < 0)
+            *out++ = '-';
+         out += write_integer(out, exponent < 0 ? -exponent : exponent);
+         *out = '\0';
+         return std::strtod(text, 0) == d;
       }
 
-      void end_array()
+      /// Drops digits one at a time while the digits rounded down or up still read back as
+      /// d. When some shorter digits read back, so do the ones next to the digits with one
+      /// fewer, as the numbers reading back as d form an interval, so this ends shortest.
+      void shorten(char* digits, int& length, int& exponent, double d)
       {
-         --indent_level;
-         if (skip == skip_none)
+         while (length > 1)
          {
-            newline();
-         }
+            // Round the digits without the last one up, dropping the nines that carry.
+            char up[17];
+            std::memcpy(up, digits, length - 1);
+            int i = length - 2;
+            while (i >= 0 && up[i] == '9')
+               --i;
+
+            const int up_exponent = exponent + 1 + (length - 2 - i);
+            int up_length = 1;
+            if (i >= 0)
+            {
+               ++up[i];
+               up_length = i + 1;
+            }
+            else
+            {
+               up[0] = '1';
+            }
 
-         os << ']';
-         skip = skip_none;
-      }
+            const bool round_up = digits[length - 1] >= '5';
+            if (round_up && reads_back(up, up_length, up_exponent, d))
+            {
+               std::memcpy(digits, up, up_length);
+               length = up_length;
+               exponent = up_exponent;
+            }
+            else if (reads_back(digits, length - 1, exponent + 1, d))
+            {
+               --length;
+               ++exponent;
+            }
+            else if (!round_up && reads_back(up, up_length, up_exponent, d))
+            {
+               std::memcpy(digits, up, up_length);
+               length = up_length;
+               exponent = up_exponent;
+            }
+            else
+            {
+               break;
+            }
 
-      void begin_object()
-      {
-         os << '{';
-         skip = skip_comma_and_newline;
-         ++indent_level;
+            while (length > 1 && digits[length - 1] == '0')
+            {
+               --length;
+               ++exponent;
+            }
+         }
       }
 
-      void end_object()
+      /// Formats a number as written by json_write_number, returning the length.
+      ///
+      /// Integral values below 10^16 are written as integers, other finite numbers with the
+      /// shortest digits that read back as the same double, in the notation printf chooses
+      /// for %.16g: fixed for decimal exponents from -4 to 15, exponent notation otherwise.
+      /// Negative zero is written as 0. NaN is written as null and infinities as the strings
+      /// "-inf" and "+inf".
+      int format_number(char (&buffer)[32], double d)
       {
-         --indent_level;
-         if (skip == skip_none)
+         boost::uint64_t bits;
+         std::memcpy(&bits, &d, sizeof(bits));
+
+         const boost::uint64_t sign = static_cast<boost::uint64_t>(1) << 63;
+         const boost::uint64_t exponent_mask = static_cast<boost::uint64_t>(0x7ffu) << 52;
+         if ((bits & exponent_mask) == exponent_mask)
          {
-            newline();
+            if ((bits & ~(sign | exponent_mask)) != 0)
+            {
+               std::memcpy(buffer, "null", 4);
+               return 4;
+            }
+
+            std::memcpy(buffer, (bits & sign) ? "\"-inf\"" : "\"+inf\"", 6);
+            return 6;
          }
 
-         os << '}';
-         skip = skip_none;
-      }
+         if (bits == sign)
+         {
+            buffer[0] = '0';
+            return 1;
+         }
 
-      void begin_key()
-      {
-         if (skip == skip_none)
+         char* out = buffer;
+         if (bits & sign)
          {
-            os << ',';
+            *out++ = '-';
+            bits &= ~sign;
+            d = -d;
          }
 
-         newline();
-         skip = skip_none;
-      }
+         if (d < 1e16 && d == static_cast<double>(static_cast<boost::uint64_t>(d)))
+            return static_cast<int>(out - buffer) + write_integer(out, static_cast<boost::uint64_t>(d));
 
-      void end_key()
-      {
-         os << ':';
-         os << ' ';
-         skip = skip_comma_and_newline;
-      }
+         char digits[17];
+         int length, exponent;
+         if (!grisu2(bits, digits, length, exponent))
+            shorten(digits, length, exponent, d);
 
-      void begin_value()
-      {
-         if (skip == skip_none)
+         // The decimal point is at position n in the digits.
+         const int n = length + exponent;
+         if (n >= -3 && n <= 16)
          {
-            os << ',';
-            newline();
+            if (n <= 0)
+            {
+               *out++ = '0';
+               *out++ = '.';
+               std::memset(out, '0', -n);
+               out += -n;
+               std::memcpy(out, digits, length);
+               out += length;
+            }
+            else if (n < length)
+            {
+               std::memcpy(out, digits, n);
+               out += n;
+               *out++ = '.';
+               std::memcpy(out, digits + n, length - n);
+               out += length - n;
+            }
+            else
+            {
+               std::memcpy(out, digits, length);
+               out += length;
+               std::memset(out, '0', n - length);
+               out += n - length;
+            }
          }
-         else if (skip == skip_comma_xor_newline)
+         else
          {
-            newline();
+            *out++ = digits[0];
+            if (length > 1)
+            {
+               *out++ = '.';
+               std::memcpy(out, digits + 1, length - 1);
+               out += length - 1;
+            }
+
+            *out++ = 'e';
+            *out++ = n - 1 < 0 ? '-' : '+';
+            const int e = n - 1 < 0 ? 1 - n : n - 1;
+            if (e < 10)
+               *out++ = '0';
+            out += write_integer(out, e);
          }
 
-         skip = skip_none;
+         return static_cast<int>(out - buffer);
       }
+   }
 
-      void end_value()
+   namespace detail
+   {
+      double json_decimal_to_double(const char* digits, size_t length, long exponent)
       {
-      }
-   };
+         if (length == 0)
+            return 0;
 
-   const json_value json_value::null;
-   const std::string json_value::empty_string;
+         // Up to 15 digits and powers of ten up to 10^22 are exact doubles,
+         // so a single multiplication or division rounds correctly.
+         static const double powers[] =
+         {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+         };
 
-   json_value::json_value(const json_value& rhs)
-      : vt(rhs.vt)
-      , vd(rhs.vd)
-   {
-      switch (vt)
-      {
-      case variant_type_string:
-         vd.s = new std::string(*vd.s);
-         break;
-      case variant_type_array:
-         vd.a = new variant_data::a_type(*vd.a);
-         break;
-      case variant_type_object:
-         vd.o = new variant_data::o_type(*vd.o);
-         break;
-      default:
-         break;
+         if (length <= 15 && exponent >= -22 && exponent <= 22)
+         {
+            double integer = 0;
+            for (size_t i = 0; i < length; ++i)
+               integer = integer * 10 + (digits[i] - '0');
+
+            return exponent < 0 ? integer / powers[-exponent] : integer * powers[exponent];
+         }
+
+         // Far beyond the range of doubles, whatever the digits.
+         const long magnitude = exponent + static_cast<long>(length);
+         if (magnitude > 400)
+            return std::numeric_limits<double>::infinity();
+         if (magnitude < -400)
+            return 0;
+
+         // The text has no decimal point, so strtod, which rounds
+         // correctly, reads it the same in every locale.
+         char text[json_max_digits + 16];
+         std::memcpy(text, digits, length);
+         char* out = text + length;
+         *out++ = 'e';
+         if (exponent < 0)
+            *out++ = '-';
+         out += write_integer(out, exponent < 0 ? -exponent : exponent);
+         *out = '\0';
+         return std::strtod(text, 0);
       }
    }
 
-   json_value::~json_value()
+   /// Helper for quoting strings.
+   void json_write_quoted_string(std::ostream& os, const std::string& str)
    {
-      switch (vt)
-      {
-      case variant_type_string:
-         delete vd.s;
-         break;
-      case variant_type_array:
-         delete vd.a;
-         break;
-      case variant_type_object:
-         delete vd.o;
-         break;
-      default:
-         break;
-      }
+      write_quoted_string(os, str.data(), str.size());
    }
 
-   bool json_value::operator==(const json_value& rhs) const
+   void json_write_quoted_string(json_buffer& buffer, const std::string& str)
    {
-      if (vt != rhs.vt)
-         return false;
-
-      switch (vt)
-      {
-      case variant_type_null:
-         return true;
-      case variant_type_string:
-         return *vd.s == *rhs.vd.s;
-      case variant_type_number:
-         return _isnan(vd.n) && _isnan(rhs.vd.n) || vd.n == rhs.vd.n;
-      case variant_type_bool:
-         return vd.b == rhs.vd.b;
-      case variant_type_array:
-         return *vd.a == *rhs.vd.a;
-      case variant_type_object:
-         return *vd.o == *rhs.vd.o;
-      default:
-         return true;
-      }
+      write_quoted_string(buffer, str.data(), str.size());
    }
 
-   bool json_value::operator<(const json_value& rhs) const
+   void json_write_quoted_string(json_size_counter& counter, const std::string& str)
    {
-      if (vt < rhs.vt)
-         return true;
-
-      if (rhs.vt < vt)
-         return false;
-
-      switch (vt)
-      {
-      case variant_type_null:
-         return false;
-      case variant_type_string:
-         return *vd.s < *rhs.vd.s;
-      case variant_type_number:
-         return !_isnan(rhs.vd.n) && (_isnan(vd.n) || vd.n < rhs.vd.n);
-      case variant_type_bool:
-         return vd.b < rhs.vd.b;
-      case variant_type_array:
-         return *vd.a < *rhs.vd.a;
-      case variant_type_object:
-         return *vd.o < *rhs.vd.o;
-      default:
-         return false;
-      }
+      write_quoted_string(counter, str.data(), str.size());
    }
 
-   const json_value& json_value::get_child(size_t i) const
+   void json_write_quoted_string(json_fixed_buffer& buffer, const std::string& str)
    {
-      assert(is_null() || is_array());
-      if (!is_array())
-      {
-         return null;
-      }
-
-      if (i >= vd.a->size())
-      {
-         return null;
-      }
-
-      return (*vd.a)[i];
+      write_quoted_string(buffer, str.data(), str.size());
    }
 
-   json_value& json_value::put_child(size_t i)
+   void json_write_quoted_string(std::ostream& os, const char* str, size_t length)
    {
-      assert(is_null() || is_array());
-      if (!is_array())
-      {
-         json_value(json_array()).swap(*this);
-      }
-
-      if (i >= vd.a->size())
-      {
-         vd.a->resize(i + 1);
-      }
-
-      return (*vd.a)[i];
+      write_quoted_string(os, str, length);
    }
 
-   void json_value::set_length(size_t length)
+   void json_write_quoted_string(json_buffer& buffer, const char* str, size_t length)
    {
-      assert(is_null() || is_array());
-      if (!is_array())
-      {
-         json_value(json_array()).swap(*this);
-      }
-
-      vd.a->resize(length);
+      write_quoted_string(buffer, str, length);
    }
 
-   const json_value& json_value::get_child(const std::string& name) const
+   void json_write_quoted_string(json_size_counter& counter, const char* str, size_t length)
    {
-      assert(is_null() || is_object());
-      if (!is_object())
-      {
-         return null;
-      }
-
-      const variant_data::o_type::const_iterator i = vd.o->find(name);
-      if (i == vd.o->end())
-      {
-         return null;
-      }
-
-      return i->second;
+      write_quoted_string(counter, str, length);
    }
 
-   json_value& json_value::put_child(const std::string& name)
+   void json_write_quoted_string(json_fixed_buffer& buffer, const char* str, size_t length)
    {
-      assert(is_null() || is_object());
-      if (!is_object())
-      {
-         json_value(json_object()).swap(*this);
-      }
-
-      return vd.o->insert(std::make_pair(name, null)).first->second;
+      write_quoted_string(buffer, str, length);
    }
 
-   bool json_value::has_child(const std::string& name) const
+   const char* json_find_escape(const char* first, const char* last)
    {
-      if (!is_object())
-      {
-         return false;
-      }
-
-      return vd.o->find(name) != vd.o->end();
+      return find_escape(first, last);
    }
 
-   bool json_value::erase_child(const std::string& name)
+   const char* json_write_escaped(char*& out, char* out_end, const char* first, const char* last)
    {
-      assert(is_null() || is_object());
-      if (!is_object())
+      static const char* hex = "0123456789abcdef";
+
+      while (first != last)
       {
-         return false;
+         const char* e = find_escape(first, std::min<const char*>(last, first + (out_end - out)));
+         std::memcpy(out, first, e - first);
+         out += e - first;
+         first = e;
+         if (first == last || out == out_end)
+            break;
+
+         const unsigned char c = static_cast<unsigned char>(*first);
+         if (escape_table[c] == 0)
+            break;
+
+         const size_t length = escape_table[c] == 'u' ? 6 : 2;
+         if (static_cast<size_t>(out_end - out) < length)
+            break;
+
+         const char escape[] = { '\\', escape_table[c], '0', '0', hex[c >> 4], hex[c & 0xfu] };
+         std::memcpy(out, escape, length);
+         out += length;
+         ++first;
       }
 
-      return vd.o->erase(name) != 0;
+      return first;
    }
 
-   std::string json_value::to_pretty_string(size_t indent_size) const
+   /// Helper for writing numbers.
+   void json_write_number(std::ostream& os, double d)
    {
-      std::ostringstream ss;
-      pretty_print(ss, indent_size);
-      return ss.str();
+      char buffer[32];
+      os.write(buffer, format_number(buffer, d));
    }
 
-   std::ostream& json_value::pretty_print(std::ostream& os, size_t indent_size) const
+   void json_write_number(json_buffer& buffer, double d)
    {
-      json_pretty_printer writer(os, indent_size);
-      accept(writer);
-      return os;
+      char number[32];
+      buffer.write(number, format_number(number, d));
    }
 
-   std::string json_value::to_string() const
+   void json_write_number(json_size_counter& counter, double d)
    {
-      std::ostringstream ss;
-      ss << *this;
-      return ss.str();
+      char number[32];
+      counter.size += format_number(number, d);
    }
 
-   std::ostream& operator<<(std::ostream& os, const json_value& rhs)
+   void json_write_number(json_fixed_buffer& buffer, double d)
    {
-      json_writer writer(os);
-      rhs.accept(writer);
-      return os;
+      char number[32];
+      buffer.write(number, format_number(number, d));
    }
+
+   BOOST_STATIC_ASSERT(sizeof(json_value) == 16);
+   BOOST_STATIC_ASSERT(sizeof(json_compact_value) == 8);
+
+   template class basic_json_value<json_tagged_layout>;
+   template class basic_json_value<json_nan_boxed_layout>;
 }
@@ -7,29 +7,28 @@
 #if !defined(ADHD_JSON_VALUE_H)
 #define ADHD_JSON_VALUE_H
 
+#include "json_writer.h"
+#include "json_object_storage.h"
+#include "json_allocator.h"
+#include <boost/container/pmr/polymorphic_allocator.hpp>
 #include <boost/utility/enable_if.hpp>
 #include <boost/type_traits/is_same.hpp>
 #include <boost/static_assert.hpp>
+#include <boost/config.hpp>
+#include <boost/atomic.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/predef/other/endian.h>
+#include <boost/functional/hash.hpp>
+#include <boost/range/iterator_range.hpp>
+#include <algorithm>
+#include <functional>
+#include <iterator>
 #include <stdexcept>
-#include <iosfwd>
 #include <string>
 #include <vector>
-#include <map>
 #include <assert.h>
-
-#if !defined(ADHD_JSON_API)
-#  ifdef _WIN32
-#     if defined(ADHD_JSON_EXPORT)
-#        define ADHD_JSON_API __declspec(dllexport)
-#     elif defined(ADHD_JSON_IMPORT)
-#        define ADHD_JSON_API __declspec(dllimport)
-#     else
-#        define ADHD_JSON_API
-#     endif
-#  else
-#     define ADHD_JSON_API
-#  endif
-#endif
+#include <string.h>
 
 namespace adhd
 {
@@ -81,344 +80,3345 @@ namespace adhd
    {
    };
 
-   /// JavaScript Object Notation (JSON) is a lightweight, text-based,
-   /// language-independent data interchange format. It was derived from
-   /// the ECMAScript Programming Language Standard. JSON defines a small
-   /// set of formatting rules for the portable representation of structured
-   /// data.
-   ///
-   /// JSON can represent four primitive types (strings, numbers, booleans,
-   /// and null) and two structured types (objects and arrays).
-   ///
-   /// Where:
-   ///    - An object is an unordered collection of zero or more name/value
-   ///      pairs, where a name is a string and a value is a string, number,
-   ///      boolean, null, object, or array.
-   ///
-   ///    - An array is an ordered sequence of zero or more values.
-   ///
-   /// See:
-   /// * http://www.json.org/
-   /// * http://www.ietf.org/rfc/rfc4627
-   ///
-   /// This class could be seen as the result of the NIH syndrome. But when
-   /// searching the net an existing library wasn't found which had an
-   /// acceptable license model, acceptable number of bugs, acceptable
-   /// performance, acceptable code bloat and acceptable required features.
-   class ADHD_JSON_API json_value
+   /// Represents a JSON value of type array holding the numbers in
+   /// [first, last), stored packed, see basic_json_value::pack.
+   struct json_packed_array
    {
-   public:
-      json_value()
-         : vt(variant_type_null)
-         , vd()
-      {
-      }
+      json_packed_array(const double* first, const double* last) : first(first), last(last) {}
+      const double* first;
+      const double* last;
+   };
 
-      json_value(const json_null& /*val*/)
-         : vt(variant_type_null)
-         , vd()
-      {
-      }
+   /// Represents a JSON array or object given as JSON text, kept verbatim
+   /// and parsed only when its elements or members are asked for, see
+   /// basic_json_value::is_raw.
+   struct json_raw
+   {
+      explicit json_raw(boost::string_ref text) : text(text) {}
+      boost::string_ref text;
+   };
 
-      json_value(const json_string& val)
-         : vt(variant_type_string)
-         , vd(val.val)
-      {
-      }
+   template <typename TValue>
+   class basic_json_reclaimer;
 
-      explicit json_value(const std::string& val)
-         : vt(variant_type_string)
-         , vd(val)
+   namespace detail
+   {
+      /// Type of the value held by a basic_json_value, in comparison order.
+      enum json_variant_type
       {
-      }
+         variant_type_null,
+         variant_type_string,
+         variant_type_number,
+         variant_type_bool,
+         variant_type_array,
+         variant_type_object,
+      };
 
-      json_value(const json_number& val)
-         : vt(variant_type_number)
-         , vd(val.val)
+      inline bool json_isnan(double d)
       {
+         return d != d;
       }
 
-      explicit json_value(double val)
-         : vt(variant_type_number)
-         , vd(val)
+      /// True for the whitespace characters of the JSON grammar.
+      inline bool json_isspace(char c)
       {
+         return c == ' ' || c == '\t' || c == '\n' || c == '\r';
       }
 
-      template <class T>
-      explicit json_value(T, typename boost::enable_if< boost::is_same<T, bool> >::type* = 0)
+      /// Reference count shared by the heap payloads of basic_json_value.
+      /// The count is atomic so copies may be handed to other threads.
+      struct json_node_base
       {
-         // prevent direct initialization from bool, use the json_value(json_bool) constructor instead.
-         BOOST_STATIC_ASSERT(false);
-      }
+         json_node_base()
+            : refs(1)
+         {
+         }
 
-      json_value(const json_bool& val)
-         : vt(variant_type_bool)
-         , vd(val)
-      {
-      }
+         void add_ref()
+         {
+            refs.fetch_add(1, boost::memory_order_relaxed);
+         }
 
-      json_value(const json_array& val)
-         : vt(variant_type_array)
-         , vd(val)
-      {
-      }
+         /// Returns true if this was the last reference.
+         bool release()
+         {
+            if (refs.fetch_sub(1, boost::memory_order_release) != 1)
+               return false;
 
-      json_value(const json_object& val)
-         : vt(variant_type_object)
-         , vd(val)
-      {
-      }
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            return true;
+         }
 
-      json_value(const json_value& rhs);
+         bool unique() const
+         {
+            return refs.load(boost::memory_order_acquire) == 1;
+         }
 
-      json_value& operator=(json_value rhs)
-      {
-         swap(rhs);
-         return *this;
-      }
+         boost::atomic<unsigned> refs;
 
-      ~json_value();
+      private:
+         json_node_base(const json_node_base&);
+         json_node_base& operator=(const json_node_base&);
+      };
 
-      void swap(json_value& rhs)
+      /// Reference counted node remembering the allocator it was allocated with.
+      template <typename TAllocator>
+      struct json_allocated_node : json_node_base
       {
-         std::swap(vt, rhs.vt);
-         std::swap(vd, rhs.vd);
-      }
+         typedef TAllocator allocator_type;
 
-      /// Recursively visits the visitor.
-      template <typename TVisitor>
-      void accept(TVisitor& visitor) const
-      {
-         switch (vt)
+         explicit json_allocated_node(const TAllocator& alloc)
+            : alloc(alloc)
          {
-         case variant_type_null:
-            visitor.null_value();
-            break;
-         case variant_type_string:
-            visitor.string_value(*vd.s);
-            break;
-         case variant_type_number:
-            visitor.number_value(vd.n);
-            break;
-         case variant_type_bool:
-            visitor.bool_value(vd.b);
-            break;
-         case variant_type_array:
-            visitor.begin_array();
-            for (variant_data::a_type::const_iterator i = vd.a->begin(), e = vd.a->end(); i != e; ++i)
-            {
-               visitor.begin_value();
-               i->accept(visitor);
-               visitor.end_value();
-            }
-            visitor.end_array();
-            break;
-         case variant_type_object:
-            visitor.begin_object();
-            for (variant_data::o_type::const_iterator i = vd.o->begin(), e = vd.o->end(); i != e; ++i)
-            {
-               visitor.begin_key();
-               visitor.string_value(i->first);
-               visitor.end_key();
-               visitor.begin_value();
-               i->second.accept(visitor);
-               visitor.end_value();
-            }
-            visitor.end_object();
-            break;
-         default:
-            break;
          }
-      }
 
-      bool operator==(const json_value& rhs) const;
+         TAllocator alloc;
+      };
 
-      bool operator!=(const json_value& rhs) const
+      /// Heap payload of a basic_json_value, shared between copies. The
+      /// payload uses the same allocator as the node.
+      template <typename T, typename TAllocator>
+      struct json_shared_node : json_allocated_node<TAllocator>
       {
-         return !(*this == rhs);
-      }
+         explicit json_shared_node(const TAllocator& alloc)
+            : json_allocated_node<TAllocator>(alloc)
+            , data(alloc)
+         {
+         }
 
-      bool operator<(const json_value& rhs) const;
+         json_shared_node(const T& rhs, const TAllocator& alloc)
+            : json_allocated_node<TAllocator>(alloc)
+            , data(alloc)
+         {
+            json_assign(data, rhs);
+         }
 
-      bool operator>(const json_value& rhs) const
-      {
-         return rhs < *this;
-      }
+         T data;
+      };
 
-      bool operator<=(const json_value& rhs) const
+      /// Heap payload of an array or object, caching the structural hash of
+      /// its value and, once written by to_cached_string, its compact
+      /// output. Zero means the hash is not known and a null output that
+      /// it is not cached; both are reset whenever the payload is modified.
+      /// The caches are atomic since values sharing the node may be hashed
+      /// or written concurrently.
+      template <typename T, typename TAllocator>
+      struct json_container_node : json_shared_node<T, TAllocator>
       {
-         return !(rhs > *this);
-      }
+         typedef json_shared_node<typename json_allocator_traits<TAllocator>::string_type, TAllocator> output_node;
 
-      bool operator>=(const json_value& rhs) const
-      {
-         return !(*this < rhs);
-      }
+         explicit json_container_node(const TAllocator& alloc)
+            : json_shared_node<T, TAllocator>(alloc)
+            , hash(0)
+            , output(0)
+            , leaked(false)
+         {
+         }
+
+         json_container_node(const T& rhs, const TAllocator& alloc)
+            : json_shared_node<T, TAllocator>(rhs, alloc)
+            , hash(0)
+            , output(0)
+            , leaked(false)
+         {
+         }
 
-      typedef const std::string& (json_value::*unspecified_bool_type)() const;
+         ~json_container_node()
+         {
+            if (output_node* o = output.load(boost::memory_order_acquire))
+               json_delete_node(o);
+         }
 
-      operator unspecified_bool_type() const
+         /// Drops the caches, before the payload is modified.
+         void modified()
+         {
+            hash.store(0, boost::memory_order_relaxed);
+            if (output_node* o = output.exchange(0, boost::memory_order_acquire))
+               json_delete_node(o);
+         }
+
+         mutable boost::atomic<size_t> hash;
+         mutable boost::atomic<output_node*> output;
+
+         /// Set once a reference to a child has been handed out, by
+         /// put_child or the like. The child may then be written without
+         /// the node knowing, so the node is never shared again: copies of
+         /// the value copy it at once. Only the value owning the node sets
+         /// the flag, and it is never cleared.
+         mutable bool leaked;
+      };
+
+      /// Heap payload of an array of numbers packed as plain doubles. The
+      /// elements are expanded into values, TElements, only when references
+      /// to them are asked for, and are then kept with the payload. The
+      /// expansion is published atomically since values sharing the node
+      /// may ask for it concurrently.
+      template <typename TNumbers, typename TElements, typename TAllocator>
+      struct json_packed_node : json_container_node<TNumbers, TAllocator>
       {
-         return is_null() ? 0 : &json_value::get_string;
-      }
+         explicit json_packed_node(const TAllocator& alloc)
+            : json_container_node<TNumbers, TAllocator>(alloc)
+            , elements(0)
+         {
+         }
 
-      bool operator!() const
+         json_packed_node(const TNumbers& rhs, const TAllocator& alloc)
+            : json_container_node<TNumbers, TAllocator>(rhs, alloc)
+            , elements(0)
+         {
+         }
+
+         ~json_packed_node()
+         {
+            if (TElements* e = elements.load(boost::memory_order_acquire))
+               json_delete_node(e);
+         }
+
+         mutable boost::atomic<TElements*> elements;
+      };
+
+      /// Node holding a single TValue.
+      template <typename TValue, typename TAllocator>
+      struct json_value_node : json_allocated_node<TAllocator>
       {
-         return is_null();
-      }
+         explicit json_value_node(const TAllocator& alloc)
+            : json_allocated_node<TAllocator>(alloc)
+         {
+         }
 
-      bool is_null() const
+         TValue data;
+      };
+
+      /// Heap payload of an array or object held as JSON text. The text is
+      /// parsed into TParsed, a json_value_node, only when the elements or
+      /// members are asked for, and the result is then kept with the
+      /// payload. The result is published atomically since values sharing
+      /// the node may ask for it concurrently.
+      template <typename TText, typename TParsed, typename TAllocator>
+      struct json_raw_node : json_container_node<TText, TAllocator>
       {
-         return vt == variant_type_null;
-      }
+         explicit json_raw_node(const TAllocator& alloc)
+            : json_container_node<TText, TAllocator>(alloc)
+            , parsed(0)
+         {
+         }
 
-      bool is_string() const
+         json_raw_node(const TText& rhs, const TAllocator& alloc)
+            : json_container_node<TText, TAllocator>(rhs, alloc)
+            , parsed(0)
+         {
+         }
+
+         ~json_raw_node()
+         {
+            if (TParsed* p = parsed.load(boost::memory_order_acquire))
+               json_delete_node(p);
+         }
+
+         mutable boost::atomic<TParsed*> parsed;
+      };
+
+      /// Checks that text is a JSON array or object, throwing
+      /// json_parse_exception if not. Defined in json_parser.h.
+      inline void json_validate_raw(const char* text);
+
+      /// Parses text, a JSON array or object, into value. Defined in json_parser.h.
+      template <typename TValue>
+      void json_parse_raw(const char* text, TValue& value, const typename TValue::allocator_type& alloc);
+
+      template <typename TVisitor>
+      void json_visit_string(TVisitor& visitor, const std::string& str)
       {
-         return vt == variant_type_string;
+         visitor.string_value(str);
       }
 
-      const std::string& get_string() const
+      /// Passes a string of another string type to a visitor as a std::string.
+      template <typename TVisitor, typename TString>
+      void json_visit_string(TVisitor& visitor, const TString& str)
       {
-         assert(is_string());
-         return is_string() ? *vd.s : empty_string;
+         visitor.string_value(std::string(str.data(), str.size()));
       }
 
-      bool is_number() const
+      /// The writers quote strings of any type in place.
+      template <typename TOutput>
+      void json_visit_string(basic_json_writer<TOutput>& writer, const std::string& str)
       {
-         return vt == variant_type_number;
+         writer.string_value(str.data(), str.size());
       }
 
-      double get_number() const
+      template <typename TOutput, typename TString>
+      void json_visit_string(basic_json_writer<TOutput>& writer, const TString& str)
       {
-         assert(is_number());
-         return is_number() ? vd.n : 0;
+         writer.string_value(str.data(), str.size());
       }
 
-      bool is_bool() const
+      template <typename TOutput>
+      void json_visit_string(basic_json_pretty_printer<TOutput>& writer, const std::string& str)
       {
-         return vt == variant_type_bool;
+         writer.string_value(str.data(), str.size());
       }
 
-      bool get_bool() const
+      template <typename TOutput, typename TString>
+      void json_visit_string(basic_json_pretty_printer<TOutput>& writer, const TString& str)
       {
-         assert(is_bool());
-         return is_bool() ? vd.b : false;
+         writer.string_value(str.data(), str.size());
       }
 
-      bool is_array() const
+      /// Explicit stack for the traversals of basic_json_value, replacing
+      /// recursion so that nesting depth is bounded only by memory. The
+      /// first TInline items are kept in the stack object itself, deeper
+      /// items on the heap.
+      template <typename T, size_t TInline>
+      class json_stack
       {
-         return vt == variant_type_array;
-      }
+      public:
+         json_stack()
+            : count(0)
+         {
+         }
 
-      const json_value& get_child(size_t i) const;
+         bool empty() const
+         {
+            return count == 0;
+         }
 
-      json_value& put_child(size_t i);
+         T& back()
+         {
+            return count <= TInline ? items[count - 1] : overflow.back();
+         }
 
-      json_value& append_child()
-      {
-         return put_child(get_length());
-      }
+         void push_back(const T& item)
+         {
+            if (count < TInline)
+               items[count] = item;
+            else
+               overflow.push_back(item);
+            ++count;
+         }
 
-      size_t get_length() const
-      {
-         return is_array() ? vd.a->size() : 0;
-      }
+         void pop_back()
+         {
+            if (count > TInline)
+               overflow.pop_back();
+            --count;
+         }
 
-      void set_length(size_t length);
+      private:
+         json_stack(const json_stack&);
+         json_stack& operator=(const json_stack&);
 
-      bool is_object() const
+         size_t count;
+         T items[TInline];
+         std::vector<T> overflow;
+      };
+   }
+
+   /// Layout policy for basic_json_value using a one byte type tag next to
+   /// an eight byte payload, 16 bytes in total. Strings of up to 14
+   /// characters are stored inline in the value itself.
+   struct json_tagged_layout
+   {
+      class storage
       {
-         return vt == variant_type_object;
-      }
+      public:
+         enum
+         {
+            /// Longest string stored inline instead of on the heap.
+            short_string_capacity = 14,
+         };
 
-      const json_value& get_child(const std::string& name) const;
+         storage()
+            : ss_length(0)
+            , vt(detail::variant_type_null)
+         {
+            d.p = 0;
+         }
+
+         detail::json_variant_type type() const
+         {
+            return static_cast<detail::json_variant_type>(vt);
+         }
 
-      json_value& put_child(const std::string& name);
+         void set_null()
+         {
+            d.p = 0;
+            ss_length = 0;
+            vt = detail::variant_type_null;
+         }
 
-      bool has_child(const std::string& name) const;
+         void set_number(double n)
+         {
+            d.n = n;
+            ss_length = 0;
+            vt = detail::variant_type_number;
+         }
 
-      bool erase_child(const std::string& name);
+         void set_bool(bool b)
+         {
+            d.p = 0;
+            d.b = b;
+            ss_length = 0;
+            vt = detail::variant_type_bool;
+         }
 
-      std::string to_pretty_string(size_t indent_size = 4) const;
+         bool set_short_string(const char* str, size_t length)
+         {
+            if (length > short_string_capacity)
+               return false;
 
-      std::ostream& pretty_print(std::ostream& os, size_t indent_size = 4) const;
+            memcpy(short_string_data(), str, length);
+            ss_length = static_cast<unsigned char>(length);
+            vt = detail::variant_type_string;
+            return true;
+         }
 
-      std::string to_string() const;
+         /// Stores the heap allocated payload of a string, array or object.
+         void set_pointer(detail::json_variant_type type, void* p)
+         {
+            d.p = p;
+            ss_length = pointer_length;
+            vt = static_cast<unsigned char>(type);
+         }
 
-      /// Predicate to check if a character should be escaped.
-      struct need_escaping
-      {
-         bool operator()(char c) const
+         /// Stores the heap allocated payload of an array of packed numbers.
+         void set_packed_pointer(void* p)
          {
-            return (c >= 0 && c < 0x20) || c == 0x7f || c == '\\' || c == '\"';
+            d.p = p;
+            ss_length = packed_pointer_length;
+            vt = detail::variant_type_array;
          }
-      };
 
-      /// Public static for representing a null JSON value.
-      static const json_value null;
+         /// Stores the heap allocated payload of an array or object held as JSON text.
+         void set_raw_pointer(detail::json_variant_type type, void* p)
+         {
+            d.p = p;
+            ss_length = raw_pointer_length;
+            vt = static_cast<unsigned char>(type);
+         }
 
-   private:
-      static const std::string empty_string;
+         bool has_pointer() const
+         {
+            return ss_length >= raw_pointer_length;
+         }
 
-      enum variant_type
-      {
-         variant_type_null,
-         variant_type_string,
-         variant_type_number,
-         variant_type_bool,
-         variant_type_array,
-         variant_type_object,
-      };
+         bool has_packed_pointer() const
+         {
+            return ss_length == packed_pointer_length;
+         }
 
-      union variant_data
-      {
-         variant_data()
-            : v()
+         bool has_raw_pointer() const
          {
+            return ss_length == raw_pointer_length;
          }
 
-         variant_data(const std::string& val)
-            : s(new std::string(val))
+         void* pointer() const
          {
+            return d.p;
          }
 
-         variant_data(double val)
-            : n(val)
+         double number() const
          {
+            return d.n;
          }
 
-         variant_data(const json_bool& val)
-            : b(val.val)
+         bool boolean() const
          {
+            return d.b;
          }
 
-         variant_data(const json_array& /*val*/)
-            : a(new a_type())
+         boost::string_ref short_string() const
          {
+            return boost::string_ref(short_string_data(), ss_length);
          }
 
-         variant_data(const json_object& /*val*/)
-            : o(new o_type())
+      private:
+         enum
+         {
+            /// Value of ss_length for heap allocated payloads.
+            pointer_length = 0xff,
+
+            /// Value of ss_length for the payload of a packed array.
+            packed_pointer_length = 0xfe,
+
+            /// Value of ss_length for the payload of a raw array or object.
+            raw_pointer_length = 0xfd,
+         };
+
+         union payload
+         {
+            void* p;
+            double n;
+            bool b;
+         };
+
+         /// Short strings overlay d and continue into ss_tail.
+         char* short_string_data()
          {
+            return reinterpret_cast<char*>(&d);
          }
 
-         typedef std::vector<json_value> a_type;
-         typedef std::map<std::string, json_value> o_type;
+         const char* short_string_data() const
+         {
+            return reinterpret_cast<const char*>(&d);
+         }
 
-         void* v;
-         std::string* s;
-         double n;
-         bool b;
-         a_type* a;
-         o_type* o;
+         payload d;
+         char ss_tail[short_string_capacity - sizeof(payload)];
+         unsigned char ss_length;
+         unsigned char vt;
       };
-
-      variant_type vt;
-      variant_data vd;
    };
 
-   /// Outputs a JSON value to a stream in a compact way.
-   ADHD_JSON_API std::ostream& operator<<(std::ostream& os, const json_value& rhs);
-}
+   /// Layout policy for basic_json_value using NaN boxing, 8 bytes in total.
+   /// Numbers are stored as plain doubles, with every NaN folded into one
+   /// canonical quiet NaN. All other values are stored in the payload of
+   /// negative quiet NaNs, which no arithmetic produces: a 3 bit type tag
+   /// and 48 bits of payload holding a boolean, a pointer or a string of up
+   /// to 5 characters. Requires heap pointers to fit in 48 bits, which holds
+   /// for user space on current x86-64 and AArch64 systems.
+   struct json_nan_boxed_layout
+   {
+      class storage
+      {
+      public:
+         enum
+         {
+            /// Longest string stored inline instead of on the heap.
+            short_string_capacity = 5,
+         };
+
+         storage()
+            : bits(box(detail::variant_type_null, 0))
+         {
+         }
+
+         detail::json_variant_type type() const
+         {
+            if (!is_boxed())
+               return detail::variant_type_number;
+
+            const unsigned t = tag();
+            if (t >= short_string_tag)
+               return t == short_string_tag ? detail::variant_type_string : detail::variant_type_array;
+
+            if (t == raw_tag)
+               return (bits & raw_object_bit) ? detail::variant_type_object : detail::variant_type_array;
+
+            return static_cast<detail::json_variant_type>(t);
+         }
+
+         void set_null()
+         {
+            bits = box(detail::variant_type_null, 0);
+         }
+
+         void set_number(double n)
+         {
+            if (detail::json_isnan(n))
+               bits = static_cast<boost::uint64_t>(0x7ff8u) << 48;
+            else
+               memcpy(&bits, &n, sizeof(bits));
+         }
+
+         void set_bool(bool b)
+         {
+            bits = box(detail::variant_type_bool, b ? 1 : 0);
+         }
+
+         bool set_short_string(const char* str, size_t length)
+         {
+            if (length > short_string_capacity)
+               return false;
+
+            bits = box(short_string_tag, static_cast<boost::uint64_t>(length) << 40);
+            memcpy(reinterpret_cast<char*>(&bits) + short_string_offset, str, length);
+            return true;
+         }
+
+         /// Stores the heap allocated payload of a string, array or object.
+         void set_pointer(detail::json_variant_type type, void* p)
+         {
+            const boost::uint64_t address = reinterpret_cast<boost::uintptr_t>(p);
+            assert((address & ~payload_mask()) == 0);
+            bits = box(type, address);
+         }
+
+         /// Stores the heap allocated payload of an array of packed numbers.
+         void set_packed_pointer(void* p)
+         {
+            const boost::uint64_t address = reinterpret_cast<boost::uintptr_t>(p);
+            assert((address & ~payload_mask()) == 0);
+            bits = box(packed_array_tag, address);
+         }
+
+         /// Stores the heap allocated payload of an array or object held as JSON text.
+         void set_raw_pointer(detail::json_variant_type type, void* p)
+         {
+            const boost::uint64_t address = reinterpret_cast<boost::uintptr_t>(p);
+            assert((address & ~payload_mask()) == 0 && (address & raw_object_bit) == 0);
+            bits = box(raw_tag, address | (type == detail::variant_type_object ? raw_object_bit : 0));
+         }
+
+         bool has_pointer() const
+         {
+            if (!is_boxed())
+               return false;
+
+            const unsigned t = tag();
+            return t == detail::variant_type_string || t == detail::variant_type_array || t == detail::variant_type_object || t == packed_array_tag || t == raw_tag;
+         }
+
+         bool has_packed_pointer() const
+         {
+            return is_boxed() && tag() == packed_array_tag;
+         }
+
+         bool has_raw_pointer() const
+         {
+            return is_boxed() && tag() == raw_tag;
+         }
+
+         void* pointer() const
+         {
+            return reinterpret_cast<void*>(static_cast<boost::uintptr_t>(bits & payload_mask() & ~static_cast<boost::uint64_t>(raw_object_bit)));
+         }
+
+         double number() const
+         {
+            double n;
+            memcpy(&n, &bits, sizeof(n));
+            return n;
+         }
+
+         bool boolean() const
+         {
+            return (bits & 1) != 0;
+         }
+
+         boost::string_ref short_string() const
+         {
+            return boost::string_ref(reinterpret_cast<const char*>(&bits) + short_string_offset, static_cast<size_t>((bits >> 40) & 0xff));
+         }
+
+      private:
+         enum
+         {
+            /// Tag of strings stored inline; tags below are json_variant_type values.
+            short_string_tag = 6,
+
+            /// Tag of arrays of packed numbers.
+            packed_array_tag = 7,
+
+            /// Tag of arrays and objects held as JSON text. Numbers are never
+            /// boxed, which leaves their tag free.
+            raw_tag = detail::variant_type_number,
+
+            /// Bit of the payload of raw values set for objects. Nodes are
+            /// aligned, so the lowest bit of their address is always clear.
+            raw_object_bit = 1,
+
+#if BOOST_ENDIAN_BIG_BYTE
+            short_string_offset = 3,
+#else
+            short_string_offset = 0,
+#endif
+         };
+
+         static boost::uint64_t payload_mask()
+         {
+            return (static_cast<boost::uint64_t>(1) << 48) - 1;
+         }
+
+         static boost::uint64_t box(unsigned t, boost::uint64_t payload)
+         {
+            return static_cast<boost::uint64_t>(0xfff8u | t) << 48 | payload;
+         }
+
+         bool is_boxed() const
+         {
+            return (bits >> 51) == 0x1fffu;
+         }
+
+         unsigned tag() const
+         {
+            return static_cast<unsigned>(bits >> 48) & 7;
+         }
+
+         boost::uint64_t bits;
+      };
+   };
+
+   /// JavaScript Object Notation (JSON) is a lightweight, text-based,
+   /// language-independent data interchange format. It was derived from
+   /// the ECMAScript Programming Language Standard. JSON defines a small
+   /// set of formatting rules for the portable representation of structured
+   /// data.
+   ///
+   /// JSON can represent four primitive types (strings, numbers, booleans,
+   /// and null) and two structured types (objects and arrays).
+   ///
+   /// Where:
+   ///    - An object is an unordered collection of zero or more name/value
+   ///      pairs, where a name is a string and a value is a string, number,
+   ///      boolean, null, object, or array.
+   ///
+   ///    - An array is an ordered sequence of zero or more values.
+   ///
+   /// See:
+   /// * http://www.json.org/
+   /// * http://www.ietf.org/rfc/rfc4627
+   ///
+   /// This class could be seen as the result of the NIH syndrome. But when
+   /// searching the net an existing library wasn't found which had an
+   /// acceptable license model, acceptable number of bugs, acceptable
+   /// performance, acceptable code bloat and acceptable required features.
+   ///
+   /// The in-memory representation of a value is chosen by the layout
+   /// policy, see json_tagged_layout and json_nan_boxed_layout, and the
+   /// object storage policy, see json_object_storage.h. Iteration order of
+   /// object members depends on the object storage policy.
+   ///
+   /// Strings, arrays and objects are reference counted and shared between
+   /// copies, so copying a value is O(1). An array or object is cloned, one
+   /// level deep, the first time it is modified through put_child,
+   /// set_length or erase_child while shared. As with other copy-on-write
+   /// containers, a reference returned by put_child must not be used to
+   /// modify the value after the value, or a value containing it, has been
+   /// copied, hashed or written by to_cached_string, as the hash and the
+   /// output of an array or object are cached until it is modified through
+   /// one of these.
+   ///
+   /// An array holding only numbers may be stored packed, see pack(), as
+   /// plain doubles without a type tag per element. json_builder builds
+   /// such arrays packed. Since get_child returns references to values, it
+   /// expands the elements of a packed array into values the first time
+   /// it is called, and the packed array then holds both. Modifying a
+   /// packed array turns it back into an array of values.
+   ///
+   /// An array or object may also be held as its JSON text, see json_raw
+   /// and is_raw, which the compact writers copy as it is. The text is
+   /// parsed the first time the elements or members are asked for, and
+   /// the raw value compares and hashes as the array or object it holds.
+   ///
+   /// Strings, arrays and objects are allocated with TAllocator, rebound
+   /// to the node type, and each node keeps a copy of the allocator it was
+   /// allocated with. The allocator is given when constructing a string,
+   /// array or object, and is passed on to the values created by
+   /// json_builder and by the allocator extended copy constructor, which
+   /// makes a deep copy. Arrays and objects created implicitly by put_child
+   /// and set_length on a null value use a default constructed allocator.
+   /// Values using different allocators may be assigned to each other, a
+   /// node is always freed through its own allocator, but the memory
+   /// backing a node must then outlive every value sharing it.
+   template <typename TLayout = json_tagged_layout, typename TObjects = json_adaptive_objects<>, typename TAllocator = std::allocator<char> >
+   class basic_json_value
+   {
+      typedef typename detail::json_allocator_traits<TAllocator>::template vector<basic_json_value>::type array_type;
+      typedef typename TObjects::template container<basic_json_value, TAllocator>::type object_type;
+
+   public:
+      typedef TLayout layout_type;
+      typedef TObjects objects_type;
+      typedef TAllocator allocator_type;
+
+      /// Iterators over the elements of an array, see elements().
+      typedef typename array_type::iterator element_iterator;
+      typedef typename array_type::const_iterator const_element_iterator;
+
+      /// Iterators over the members of an object, see members(). Members
+      /// are proxies returned by value, with a first, the name as a
+      /// boost::string_ref, and a second, a reference to the value, so that
+      /// names can never be modified. A member_iterator converts to a
+      /// const_member_iterator.
+      typedef typename object_type::iterator member_iterator;
+      typedef typename object_type::const_iterator const_member_iterator;
+
+      basic_json_value()
+         : st()
+      {
+      }
+
+      basic_json_value(const json_null& /*val*/)
+         : st()
+      {
+      }
+
+      basic_json_value(const json_string& val, const allocator_type& alloc = allocator_type())
+      {
+         init_string(val.val.data(), val.val.size(), alloc);
+      }
+
+      explicit basic_json_value(const std::string& val, const allocator_type& alloc = allocator_type())
+      {
+         init_string(val.data(), val.size(), alloc);
+      }
+
+      basic_json_value(const json_number& val)
+      {
+         st.set_number(val.val);
+      }
+
+      explicit basic_json_value(double val)
+      {
+         st.set_number(val);
+      }
+
+      template <class T>
+      explicit basic_json_value(T, typename boost::enable_if< boost::is_same<T, bool> >::type* = 0)
+      {
+         // prevent direct initialization from bool, use the basic_json_value(json_bool) constructor instead.
+         BOOST_STATIC_ASSERT(sizeof(T) == 0);
+      }
+
+      basic_json_value(const json_bool& val)
+      {
+         st.set_bool(val.val);
+      }
+
+      basic_json_value(const json_array& /*val*/, const allocator_type& alloc = allocator_type())
+      {
+         st.set_pointer(detail::variant_type_array, static_cast<detail::json_node_base*>(detail::json_new_node<array_node>(alloc)));
+      }
+
+      basic_json_value(const json_object& /*val*/, const allocator_type& alloc = allocator_type())
+      {
+         st.set_pointer(detail::variant_type_object, static_cast<detail::json_node_base*>(detail::json_new_node<object_node>(alloc)));
+      }
+
+      /// Empty object to be given the same member names as like, letting
+      /// object storage which shares names between objects, such as
+      /// json_shaped_objects, share them with like.
+      basic_json_value(const json_object& /*val*/, const basic_json_value& like, const allocator_type& alloc = allocator_type())
+      {
+         object_node* n = detail::json_new_node<object_node>(alloc);
+         st.set_pointer(detail::variant_type_object, static_cast<detail::json_node_base*>(n));
+         if (like.is_object())
+            n->data.prepare(like.object());
+      }
+
+      basic_json_value(const json_packed_array& val, const allocator_type& alloc = allocator_type());
+
+      /// Array or object holding the JSON text of val, see is_raw. Throws
+      /// json_parse_exception if the text is not a JSON array or object.
+      basic_json_value(const json_raw& val, const allocator_type& alloc = allocator_type());
+
+      /// Copies share the payload of rhs, which is copied only once either
+      /// is modified. Arrays and objects references to children have been
+      /// taken from are copied at once, see put_child.
+      basic_json_value(const basic_json_value& rhs)
+         : st(rhs.st)
+      {
+         if (st.has_pointer())
+         {
+            node()->add_ref();
+            if (is_leaked())
+               unshare_leaked();
+         }
+      }
+
+      /// Deep copy of rhs where every string, array and object is allocated with alloc.
+      basic_json_value(const basic_json_value& rhs, const allocator_type& alloc);
+
+#if !defined(BOOST_NO_CXX11_RVALUE_REFERENCES)
+      basic_json_value(basic_json_value&& rhs) BOOST_NOEXCEPT
+         : st(rhs.st)
+      {
+         rhs.st.set_null();
+      }
+#endif
+
+      basic_json_value& operator=(basic_json_value rhs)
+      {
+         swap(rhs);
+         return *this;
+      }
+
+      ~basic_json_value();
+
+      void swap(basic_json_value& rhs)
+      {
+         std::swap(st, rhs.st);
+      }
+
+      /// Recursively visits the visitor. Nesting depth is bounded only by
+      /// memory, see recursion_depth.
+      template <typename TVisitor>
+      void accept(TVisitor& visitor) const
+      {
+         accept_recursive(visitor, recursion_depth);
+      }
+
+      bool operator==(const basic_json_value& rhs) const
+      {
+         return equal_recursive(rhs, recursion_depth);
+      }
+
+      bool operator!=(const basic_json_value& rhs) const
+      {
+         return !(*this == rhs);
+      }
+
+      bool operator<(const basic_json_value& rhs) const;
+
+      bool operator>(const basic_json_value& rhs) const
+      {
+         return rhs < *this;
+      }
+
+      bool operator<=(const basic_json_value& rhs) const
+      {
+         return !(rhs > *this);
+      }
+
+      bool operator>=(const basic_json_value& rhs) const
+      {
+         return !(*this < rhs);
+      }
+
+      /// Structural hash, equal for values comparing equal. Object members
+      /// contribute independently of their order. The hash of an array or
+      /// object is cached in its node, and is computed without recursion.
+      size_t hash() const;
+
+      typedef bool (basic_json_value::*unspecified_bool_type)() const;
+
+      operator unspecified_bool_type() const
+      {
+         return is_null() ? 0 : &basic_json_value::is_null;
+      }
+
+      bool operator!() const
+      {
+         return is_null();
+      }
+
+      bool is_null() const
+      {
+         return st.type() == detail::variant_type_null;
+      }
+
+      bool is_string() const
+      {
+         return st.type() == detail::variant_type_string;
+      }
+
+      std::string get_string() const
+      {
+         const boost::string_ref str = get_string_ref();
+         return std::string(str.data(), str.size());
+      }
+
+      /// Returns a reference to the characters of a string value, valid
+      /// until the value is modified or destroyed.
+      boost::string_ref get_string_ref() const
+      {
+         assert(is_string());
+         if (!is_string())
+            return boost::string_ref();
+
+         if (st.has_pointer())
+            return boost::string_ref(long_string().data(), long_string().size());
+
+         return st.short_string();
+      }
+
+      bool is_number() const
+      {
+         return st.type() == detail::variant_type_number;
+      }
+
+      double get_number() const
+      {
+         assert(is_number());
+         return is_number() ? st.number() : 0;
+      }
+
+      bool is_bool() const
+      {
+         return st.type() == detail::variant_type_bool;
+      }
+
+      bool get_bool() const
+      {
+         assert(is_bool());
+         return is_bool() ? st.boolean() : false;
+      }
+
+      bool is_array() const
+      {
+         return st.type() == detail::variant_type_array;
+      }
+
+      const basic_json_value& get_child(size_t i) const;
+
+      /// Returns element i, appending nulls up to it if needed. The
+      /// reference stays valid when the value is copied, the copy then
+      /// getting an array of its own, and until the value is otherwise
+      /// modified or destroyed.
+      basic_json_value& put_child(size_t i);
+
+      basic_json_value& append_child()
+      {
+         return put_child(get_length());
+      }
+
+      size_t get_length() const
+      {
+         if (!is_array())
+            return 0;
+
+         if (st.has_raw_pointer())
+            return raw_value().get_length();
+
+         return st.has_packed_pointer() ? numbers().size() : array().size();
+      }
+
+      void set_length(size_t length);
+
+      /// Makes room for length elements without changing the length.
+      /// Null values become arrays.
+      void reserve(size_t length);
+
+      /// Appends the values in [first, last), converted as by the explicit
+      /// constructors, so doubles become numbers. Null values become arrays.
+      template <typename TIterator>
+      void append_children(TIterator first, TIterator last);
+
+      /// Returns the elements of an array, or an empty range if the value
+      /// is not an array. The range is valid until the value is modified
+      /// or destroyed. Iterating a packed array expands its elements, see
+      /// get_number_span for iterating the numbers as they are.
+      boost::iterator_range<const_element_iterator> elements() const
+      {
+         if (!is_array())
+            return boost::iterator_range<const_element_iterator>();
+
+         return boost::iterator_range<const_element_iterator>(array().begin(), array().end());
+      }
+
+      /// Returns the elements of an array for modifying them in place, or
+      /// an empty range if the value is not an array. The array is
+      /// unshared, and unpacked, first.
+      boost::iterator_range<element_iterator> elements()
+      {
+         if (!is_array())
+            return boost::iterator_range<element_iterator>();
+
+         array_type& a = leaked_array();
+         return boost::iterator_range<element_iterator>(a.begin(), a.end());
+      }
+
+      /// True if the value is an array or object held as JSON text. The
+      /// writers copy the text as it is, and it is parsed, once, only when
+      /// the elements or members are asked for. Modifying the value
+      /// replaces it with the parsed array or object.
+      bool is_raw() const
+      {
+         return st.has_raw_pointer();
+      }
+
+      /// Returns the JSON text of a raw array or object, valid until the
+      /// value is modified or destroyed, or an empty string if the value is
+      /// not raw.
+      boost::string_ref get_raw_text() const
+      {
+         if (!st.has_raw_pointer())
+            return boost::string_ref();
+
+         const string_type& text = static_cast<const raw_node*>(node())->data;
+         return boost::string_ref(text.data(), text.size());
+      }
+
+      /// True if the value is an array of packed numbers.
+      bool is_packed() const
+      {
+         return st.has_packed_pointer();
+      }
+
+      /// Stores an array holding only numbers as packed doubles, 8 bytes
+      /// per element, whatever the layout. Returns true if the value is
+      /// now a packed array, false if it is not an array of numbers.
+      bool pack();
+
+      /// Returns the elements of a packed array, valid until the value is
+      /// modified or destroyed, or an empty range if the value is not a
+      /// packed array.
+      boost::iterator_range<const double*> get_number_span() const
+      {
+         if (!st.has_packed_pointer() || numbers().empty())
+            return boost::iterator_range<const double*>();
+
+         return boost::iterator_range<const double*>(&numbers()[0], &numbers()[0] + numbers().size());
+      }
+
+      bool is_object() const
+      {
+         return st.type() == detail::variant_type_object;
+      }
+
+      /// Member lookups take the name as a boost::string_ref, so string
+      /// literals and other character ranges are looked up without
+      /// constructing a std::string.
+      const basic_json_value& get_child(boost::string_ref name) const;
+
+      const basic_json_value& get_child(const char* name, size_t length) const
+      {
+         return get_child(boost::string_ref(name, length));
+      }
+
+      /// Returns the named member, or null if there is no such member.
+      const basic_json_value* find_child(boost::string_ref name) const
+      {
+         return is_object() ? object().find(name) : 0;
+      }
+
+      const basic_json_value* find_child(const char* name, size_t length) const
+      {
+         return find_child(boost::string_ref(name, length));
+      }
+
+      /// Lookups by a json_key reuse the hash of the name.
+      const basic_json_value& get_child(const json_key& key) const
+      {
+         assert(is_null() || is_object());
+         const basic_json_value* child = find_child(key);
+         return child ? *child : null;
+      }
+
+      const basic_json_value* find_child(const json_key& key) const
+      {
+         return is_object() ? object().find(key) : 0;
+      }
+
+      bool has_child(const json_key& key) const
+      {
+         return find_child(key) != 0;
+      }
+
+      /// Looks up every key of keys at once, storing the member, or a
+      /// reference to null if there is no such member, in children[key
+      /// number]. children must have room for keys.size() pointers.
+      void get_children(const json_key_set& keys, const basic_json_value** children) const;
+
+      /// Returns the named member, adding a null member if there is none.
+      /// The reference is kept valid as that of put_child(size_t).
+      basic_json_value& put_child(boost::string_ref name);
+
+      basic_json_value& put_child(const char* name, size_t length)
+      {
+         return put_child(boost::string_ref(name, length));
+      }
+
+      bool has_child(boost::string_ref name) const
+      {
+         return find_child(name) != 0;
+      }
+
+      bool has_child(const char* name, size_t length) const
+      {
+         return has_child(boost::string_ref(name, length));
+      }
+
+      bool erase_child(boost::string_ref name);
+
+      /// Returns the members of an object, or an empty range if the value
+      /// is not an object, in the order of the object storage policy. The
+      /// range is valid until the value is modified or destroyed.
+      boost::iterator_range<const_member_iterator> members() const
+      {
+         if (!is_object())
+            return boost::iterator_range<const_member_iterator>();
+
+         return boost::iterator_range<const_member_iterator>(object().begin(), object().end());
+      }
+
+      /// Returns the members of an object for modifying their values in
+      /// place, or an empty range if the value is not an object. The
+      /// object is unshared first.
+      boost::iterator_range<member_iterator> members()
+      {
+         if (!is_object())
+            return boost::iterator_range<member_iterator>();
+
+         object_type& o = leaked_object();
+         return boost::iterator_range<member_iterator>(o.begin(), o.end());
+      }
+
+      bool erase_child(const char* name, size_t length)
+      {
+         return erase_child(boost::string_ref(name, length));
+      }
+
+      std::string to_pretty_string(size_t indent_size = 4) const;
+
+      std::ostream& pretty_print(std::ostream& os, size_t indent_size = 4) const;
+
+      std::string to_string() const;
+
+      /// Returns to_string(), keeping the output of each array and object
+      /// of at least output_cache_threshold characters with the array or
+      /// object, and splicing in the output kept for arrays and objects
+      /// not modified since. put_child, set_length, erase_child and the
+      /// other modifiers drop the output kept for the value they are
+      /// called on, so after modifying a few leaves through the root only
+      /// the arrays and objects on the paths to them are written again,
+      /// the rest is copied. Unlike the structural hash the output is only
+      /// kept by this function. Output mostly made of output already kept
+      /// for nested arrays and objects is not kept again, but for the value
+      /// this is called on, so the output kept takes at most twice the
+      /// memory of the output, plus that of the output of the value, however
+      /// deep the nesting. Arrays and objects references to children were
+      /// taken from, see put_child, are always written anew; copies of
+      /// them are not.
+      std::string to_cached_string() const;
+
+      /// Returns the exact length of to_string(), without producing it.
+      size_t serialized_size() const;
+
+      /// Returns the exact length of to_pretty_string(indent_size), without producing it.
+      size_t pretty_serialized_size(size_t indent_size = 4) const;
+
+      /// Writes to_string() into the size characters at data, in one pass
+      /// and without allocating. Returns the length of the whole output;
+      /// if that is larger than size only a prefix of it was written. Use
+      /// serialized_size() to allocate the exact room needed up front.
+      size_t serialize_into(char* data, size_t size) const;
+
+      /// Writes to_pretty_string(indent_size) like serialize_into.
+      size_t pretty_serialize_into(char* data, size_t size, size_t indent_size = 4) const;
+
+      /// Predicate to check if a character should be escaped.
+      struct need_escaping
+      {
+         bool operator()(char c) const
+         {
+            return (c >= 0 && c < 0x20) || c == 0x7f || c == '\\' || c == '\"';
+         }
+      };
+
+      /// Returns the allocator of the string, array or object held, or a
+      /// default constructed allocator for other values.
+      allocator_type get_allocator() const
+      {
+         if (st.has_pointer())
+            return static_cast<const detail::json_allocated_node<TAllocator>*>(node())->alloc;
+
+         return allocator_type();
+      }
+
+      /// Public static for representing a null JSON value.
+      static const basic_json_value null;
+
+   private:
+      typedef typename detail::json_allocator_traits<TAllocator>::string_type string_type;
+      typedef typename detail::json_allocator_traits<TAllocator>::template vector<double>::type number_vector;
+
+      void init_string(const char* str, size_t length, const allocator_type& alloc);
+
+      /// Shortest output kept by to_cached_string. Shorter arrays and
+      /// objects are cheaper to write again than to keep.
+      enum
+      {
+         output_cache_threshold = 32,
+      };
+
+      typedef typename detail::json_container_node<array_type, TAllocator>::output_node output_node;
+
+      /// Output of an array or object kept by to_cached_string.
+      boost::atomic<output_node*>& output_cache() const
+      {
+         if (st.has_raw_pointer())
+            return static_cast<const raw_node*>(node())->output;
+
+         if (st.has_packed_pointer())
+            return static_cast<const packed_node*>(node())->output;
+
+         if (is_array())
+            return static_cast<const array_node*>(node())->output;
+
+         return static_cast<const object_node*>(node())->output;
+      }
+
+      /// Writes an array or object with output kept, returning false if
+      /// there is none.
+      bool write_cached_output(json_buffer& buffer) const
+      {
+         if ((!is_array() && !is_object()) || is_leaked())
+            return false;
+
+         const output_node* o = output_cache().load(boost::memory_order_acquire);
+         if (!o)
+            return false;
+
+         json_write(buffer, o->data.data(), o->data.size());
+         return true;
+      }
+
+      /// Keeps the output of an array or object, written to buffer from
+      /// start on, of which covered characters are kept, or copied from
+      /// output kept, for nested arrays and objects. Returns false if the
+      /// output is not kept, being short or mostly covered.
+      bool keep_output(const json_buffer& buffer, size_t start, size_t covered) const;
+
+      /// Nesting levels handled by plain recursion in accept, operator== and
+      /// operator<. Deeper subtrees are handed to the iterative versions,
+      /// which keep their own stack, so the call stack stays bounded while
+      /// typical documents avoid the bookkeeping of an explicit stack.
+      enum
+      {
+         recursion_depth = 64,
+      };
+
+      template <typename TVisitor>
+      void accept_recursive(TVisitor& visitor, size_t depth) const
+      {
+         switch (st.type())
+         {
+         case detail::variant_type_array:
+            if (st.has_packed_pointer() || st.has_raw_pointer())
+               accept_scalar(visitor);
+            else if (depth == 0)
+               accept_iterative(visitor);
+            else
+            {
+               visitor.begin_array();
+               for (typename array_type::const_iterator i = array().begin(), e = array().end(); i != e; ++i)
+               {
+                  visitor.begin_value();
+                  i->accept_child(visitor, depth);
+                  visitor.end_value();
+               }
+               visitor.end_array();
+            }
+            break;
+         case detail::variant_type_object:
+            if (st.has_raw_pointer())
+               accept_scalar(visitor);
+            else if (depth == 0)
+               accept_iterative(visitor);
+            else
+            {
+               visitor.begin_object();
+               for (typename object_type::const_iterator i = object().begin(), e = object().end(); i != e; ++i)
+               {
+                  visitor.begin_key();
+                  detail::json_visit_string(visitor, i->first);
+                  visitor.end_key();
+                  visitor.begin_value();
+                  i->second.accept_child(visitor, depth);
+                  visitor.end_value();
+               }
+               visitor.end_object();
+            }
+            break;
+         default:
+            accept_scalar(visitor);
+            break;
+         }
+      }
+
+      /// Visits a child of a value visited at depth, scalars without a call.
+      template <typename TVisitor>
+      void accept_child(TVisitor& visitor, size_t depth) const
+      {
+         if (is_container())
+            accept_recursive(visitor, depth - 1);
+         else
+            accept_scalar(visitor);
+      }
+
+      /// Visits a packed array.
+      template <typename TVisitor>
+      void accept_packed(TVisitor& visitor) const
+      {
+         visitor.begin_array();
+         for (typename number_vector::const_iterator i = numbers().begin(), e = numbers().end(); i != e; ++i)
+         {
+            visitor.begin_value();
+            visitor.number_value(*i);
+            visitor.end_value();
+         }
+         visitor.end_array();
+      }
+
+      /// Visits an array or object without recursion.
+      template <typename TVisitor>
+      void accept_iterative(TVisitor& visitor) const
+      {
+         // The innermost array or object is kept in f, its ancestors on the stack.
+         detail::json_stack<accept_frame, 16> stack;
+         accept_frame f(this);
+         if (f.is_array)
+            visitor.begin_array();
+         else
+            visitor.begin_object();
+
+         for (;;)
+         {
+            // Visits scalar children in place, stopping at the next array or object.
+            const basic_json_value* child = 0;
+            if (f.is_array)
+            {
+               typename array_type::const_iterator i = f.element;
+               const typename array_type::const_iterator e = f.elements_end;
+               while (i != e)
+               {
+                  const basic_json_value& v = *i++;
+                  visitor.begin_value();
+                  if (v.is_container())
+                  {
+                     child = &v;
+                     break;
+                  }
+
+                  v.accept_scalar(visitor);
+                  visitor.end_value();
+               }
+
+               f.element = i;
+            }
+            else
+            {
+               typename object_type::const_iterator i = f.member;
+               const typename object_type::const_iterator e = f.members_end;
+               while (i != e)
+               {
+                  const detail::json_member_ref<const basic_json_value> m = *i++;
+                  visitor.begin_key();
+                  detail::json_visit_string(visitor, m.first);
+                  visitor.end_key();
+                  visitor.begin_value();
+                  if (m.second.is_container())
+                  {
+                     child = &m.second;
+                     break;
+                  }
+
+                  m.second.accept_scalar(visitor);
+                  visitor.end_value();
+               }
+
+               f.member = i;
+            }
+
+            if (child)
+            {
+               stack.push_back(f);
+               f = accept_frame(child);
+               if (f.is_array)
+                  visitor.begin_array();
+               else
+                  visitor.begin_object();
+            }
+            else
+            {
+               if (f.is_array)
+                  visitor.end_array();
+               else
+                  visitor.end_object();
+
+               if (stack.empty())
+                  break;
+
+               f = stack.back();
+               stack.pop_back();
+               visitor.end_value();
+            }
+         }
+      }
+
+      bool equal_recursive(const basic_json_value& rhs, size_t depth) const;
+
+      /// Compares two objects of equal size, recursing depth more levels.
+      static bool objects_equal(const object_type& lhs, const object_type& rhs, size_t depth);
+
+      /// Compares two arrays or objects without recursion.
+      bool equal_iterative(const basic_json_value& rhs) const;
+
+      /// Three way comparison, negative, zero or positive as *this is less
+      /// than, equal to or greater than rhs.
+      int compare(const basic_json_value& rhs, size_t depth) const;
+
+      /// Three way comparison of two arrays or objects without recursion.
+      int compare_iterative(const basic_json_value& rhs) const;
+
+      /// Three way comparison of two arrays of which at least one is
+      /// packed. Packed arrays hold only numbers, so the elements are
+      /// compared without descending into any of them.
+      static int compare_packed(const basic_json_value& lhs, const basic_json_value& rhs);
+
+      static int compare_numbers(double a, double b)
+      {
+         if (detail::json_isnan(a) || detail::json_isnan(b))
+            return detail::json_isnan(a) == detail::json_isnan(b) ? 0 : detail::json_isnan(a) ? -1 : 1;
+
+         return a < b ? -1 : b < a ? 1 : 0;
+      }
+
+      /// Cached hash of an array or object, zero if not known. The hash
+      /// of a leaked array or object is never known, as children may have
+      /// been written since, see json_container_node::leaked.
+      size_t cached_hash() const
+      {
+         if (st.has_raw_pointer() || is_leaked())
+            return 0;
+
+         switch (st.type())
+         {
+         case detail::variant_type_array:
+            if (st.has_packed_pointer())
+               return static_cast<const packed_node*>(node())->hash.load(boost::memory_order_relaxed);
+
+            return static_cast<const array_node*>(node())->hash.load(boost::memory_order_relaxed);
+         case detail::variant_type_object:
+            return static_cast<const object_node*>(node())->hash.load(boost::memory_order_relaxed);
+         default:
+            return 0;
+         }
+      }
+
+      /// Hashes a value hash does not descend into, see is_container, or
+      /// returns the cached hash of an array or object.
+      size_t hash_shallow() const;
+
+      /// Visits a value that is not a container, see is_container.
+      template <typename TVisitor>
+      void accept_scalar(TVisitor& visitor) const
+      {
+         switch (st.type())
+         {
+         case detail::variant_type_null:
+            visitor.null_value();
+            break;
+         case detail::variant_type_string:
+            if (st.has_pointer())
+               detail::json_visit_string(visitor, long_string());
+            else
+               visitor.string_value(std::string(st.short_string().data(), st.short_string().size()));
+            break;
+         case detail::variant_type_number:
+            visitor.number_value(st.number());
+            break;
+         case detail::variant_type_bool:
+            visitor.bool_value(st.boolean());
+            break;
+         case detail::variant_type_array:
+            if (st.has_raw_pointer())
+               visit_raw(visitor);
+            else
+               accept_packed(visitor);
+            break;
+         case detail::variant_type_object:
+            visit_raw(visitor);
+            break;
+         default:
+            break;
+         }
+      }
+
+      /// Visits a raw value as the array or object parsed from its text.
+      template <typename TVisitor>
+      void visit_raw(TVisitor& visitor) const
+      {
+         raw_value().accept(visitor);
+      }
+
+      /// Passes the text of a raw value to a compact writer as it is.
+      template <typename TOutput>
+      void visit_raw(basic_json_writer<TOutput>& writer) const
+      {
+         const string_type& text = static_cast<const raw_node*>(node())->data;
+         writer.raw_value(text.data(), text.size());
+      }
+
+      /// True for the arrays and objects the traversals descend into.
+      /// Packed arrays hold no nested values and raw values are passed on
+      /// as a whole, both are visited like scalars.
+      bool is_container() const
+      {
+         return (is_object() || is_array()) && !st.has_packed_pointer() && !st.has_raw_pointer();
+      }
+
+      /// Remaining children of an array or object being visited by accept.
+      struct accept_frame
+      {
+         accept_frame()
+            : is_array(false)
+         {
+         }
+
+         explicit accept_frame(const basic_json_value* value)
+            : is_array(value->is_array())
+         {
+            if (is_array)
+            {
+               element = value->array().begin();
+               elements_end = value->array().end();
+            }
+            else
+            {
+               member = value->object().begin();
+               members_end = value->object().end();
+            }
+         }
+
+         bool is_array;
+         typename array_type::const_iterator element;
+         typename array_type::const_iterator elements_end;
+         typename object_type::const_iterator member;
+         typename object_type::const_iterator members_end;
+      };
+
+      /// An array or object being written by to_cached_string, its
+      /// remaining children, where its output starts, and how much of its
+      /// output so far is kept for its children, see keep_output.
+      struct cache_frame
+      {
+         cache_frame()
+            : value(0)
+            , start(0)
+            , covered(0)
+            , first(true)
+         {
+         }
+
+         cache_frame(const basic_json_value* value, size_t start)
+            : value(value)
+            , children(value)
+            , start(start)
+            , covered(0)
+            , first(true)
+         {
+         }
+
+         const basic_json_value* value;
+         accept_frame children;
+         size_t start;
+         size_t covered;
+         bool first;
+      };
+
+      /// An array or object being hashed, its remaining children, and the
+      /// hashes of the children already hashed folded together.
+      struct hash_frame
+      {
+         hash_frame()
+            : value(0)
+            , seed(0)
+            , members(0)
+            , name(0)
+         {
+         }
+
+         explicit hash_frame(const basic_json_value* value)
+            : value(value)
+            , children(value)
+            , seed(value->st.type())
+            , members(0)
+            , name(0)
+         {
+            if (children.is_array)
+               boost::hash_combine(seed, value->array().size());
+         }
+
+         /// Folds in the hash of the next element, or of the value of the
+         /// member whose name hashes to name.
+         void add(size_t child)
+         {
+            if (children.is_array)
+               boost::hash_combine(seed, child);
+            else
+            {
+               // Members are summed, so the order of the members does not matter.
+               size_t member = name;
+               boost::hash_combine(member, child);
+               members += member;
+            }
+         }
+
+         /// The hash of the array or object, once every child is folded in.
+         size_t result() const
+         {
+            size_t result = seed;
+            if (!children.is_array)
+            {
+               boost::hash_combine(result, value->object().size());
+               boost::hash_combine(result, members);
+            }
+
+            return result != 0 ? result : 1;
+         }
+
+         const basic_json_value* value;
+         accept_frame children;
+         size_t seed;
+         size_t members;
+         size_t name;
+      };
+
+      /// Remaining children of a pair of arrays or objects being compared.
+      /// Objects which are not both ordered by name are marked as sorted;
+      /// operator== then matches their members by name and compare walks
+      /// member pointers sorted by name, kept in a scratch vector.
+      struct compare_frame
+      {
+         compare_frame()
+            : is_array(false)
+            , sorted(false)
+            , rhs_object(0)
+            , lhs_sorted(0)
+            , lhs_sorted_end(0)
+            , rhs_sorted(0)
+            , rhs_sorted_end(0)
+         {
+         }
+
+         compare_frame(const basic_json_value* lhs, const basic_json_value* rhs)
+            : is_array(lhs->is_array())
+            , sorted(false)
+            , rhs_object(0)
+            , lhs_sorted(0)
+            , lhs_sorted_end(0)
+            , rhs_sorted(0)
+            , rhs_sorted_end(0)
+         {
+            if (is_array)
+            {
+               lhs_element = lhs->array().begin();
+               lhs_elements_end = lhs->array().end();
+               rhs_element = rhs->array().begin();
+               rhs_elements_end = rhs->array().end();
+            }
+            else
+            {
+               lhs_member = lhs->object().begin();
+               lhs_members_end = lhs->object().end();
+               rhs_member = rhs->object().begin();
+               rhs_members_end = rhs->object().end();
+               rhs_object = &rhs->object();
+               sorted = !lhs->object().ordered() || !rhs->object().ordered();
+            }
+         }
+
+         bool is_array;
+         bool sorted;
+         typename array_type::const_iterator lhs_element;
+         typename array_type::const_iterator lhs_elements_end;
+         typename array_type::const_iterator rhs_element;
+         typename array_type::const_iterator rhs_elements_end;
+         typename object_type::const_iterator lhs_member;
+         typename object_type::const_iterator lhs_members_end;
+         typename object_type::const_iterator rhs_member;
+         typename object_type::const_iterator rhs_members_end;
+         const object_type* rhs_object;
+         size_t lhs_sorted;
+         size_t lhs_sorted_end;
+         size_t rhs_sorted;
+         size_t rhs_sorted_end;
+      };
+
+      enum shallow_equality
+      {
+         shallow_unequal,
+         shallow_equal,
+         shallow_descend,
+      };
+
+      /// Compares two values without looking at their children, telling
+      /// whether the children must be compared to decide.
+      static shallow_equality equal_shallow(const basic_json_value& lhs, const basic_json_value& rhs);
+
+      /// Three way comparison of two values without looking at their
+      /// children. Sets descend if the result depends on the children.
+      static int compare_shallow(const basic_json_value& lhs, const basic_json_value& rhs, bool& descend);
+
+      typedef detail::json_shared_node<string_type, TAllocator> string_node;
+      typedef detail::json_container_node<array_type, TAllocator> array_node;
+      typedef detail::json_container_node<object_type, TAllocator> object_node;
+      typedef detail::json_value_node<basic_json_value, TAllocator> value_node;
+      typedef detail::json_raw_node<string_type, value_node, TAllocator> raw_node;
+      typedef detail::json_packed_node<number_vector, array_node, TAllocator> packed_node;
+
+      detail::json_node_base* node() const
+      {
+         return static_cast<detail::json_node_base*>(st.pointer());
+      }
+
+      const string_type& long_string() const
+      {
+         return static_cast<const string_node*>(node())->data;
+      }
+
+      const array_type& array() const
+      {
+         if (st.has_packed_pointer())
+            return packed_elements();
+
+         if (st.has_raw_pointer())
+            return raw_value().array();
+
+         return static_cast<const array_node*>(node())->data;
+      }
+
+      /// Elements of a packed array as values, expanded on first use.
+      const array_type& packed_elements() const;
+
+      /// Allocates an array node holding the elements of a packed array as values.
+      static array_node* new_unpacked_node(const packed_node& packed);
+
+      const number_vector& numbers() const
+      {
+         return static_cast<const packed_node*>(node())->data;
+      }
+
+      /// Element i of an array, a packed element being stored in scratch.
+      const basic_json_value& element(size_t i, basic_json_value& scratch) const
+      {
+         if (!st.has_packed_pointer())
+            return array()[i];
+
+         scratch.st.set_number(numbers()[i]);
+         return scratch;
+      }
+
+      const object_type& object() const
+      {
+         if (st.has_raw_pointer())
+            return raw_value().object();
+
+         return static_cast<const object_node*>(node())->data;
+      }
+
+      /// Array or object parsed from the text of a raw value, on first use.
+      const basic_json_value& raw_value() const;
+
+      /// The array or object parsed from the text of a raw value, else the value itself.
+      const basic_json_value& without_raw() const
+      {
+         return st.has_raw_pointer() ? raw_value() : *this;
+      }
+
+      /// Replaces a raw value with the array or object parsed from its
+      /// text, sharing its nodes.
+      void unraw()
+      {
+         basic_json_value parsed(raw_value());
+         swap(parsed);
+      }
+
+      array_type& mutable_array();
+
+      object_type& mutable_object();
+
+      /// mutable_array and mutable_object for handing out references to
+      /// the children, marking the node as leaked.
+      array_type& leaked_array()
+      {
+         array_type& a = mutable_array();
+         static_cast<array_node*>(node())->leaked = true;
+         return a;
+      }
+
+      object_type& leaked_object()
+      {
+         object_type& o = mutable_object();
+         static_cast<object_node*>(node())->leaked = true;
+         return o;
+      }
+
+      /// put_child and append_child for basic_json_builder, which is done
+      /// writing each child before any copy of the value can be made, so
+      /// the node is not marked as leaked and parsed documents are shared
+      /// by copies like any other.
+      basic_json_value& build_child(boost::string_ref name)
+      {
+         return mutable_object().insert(name);
+      }
+
+      basic_json_value& build_element()
+      {
+         array_type& a = mutable_array();
+         a.resize(a.size() + 1);
+         return a.back();
+      }
+
+      /// True for an array or object whose node is leaked, see
+      /// json_container_node::leaked.
+      bool is_leaked() const
+      {
+         if (!is_container())
+            return false;
+
+         if (is_array())
+            return static_cast<const array_node*>(node())->leaked;
+
+         return static_cast<const object_node*>(node())->leaked;
+      }
+
+      /// Allocates, with alloc, a copy of the node of an array or object
+      /// whose children are shared even where they are leaked, so that a
+      /// tree of leaked nodes can be copied iteratively, the caller then
+      /// copying the leaked children.
+      detail::json_node_base* new_shallow_node(const allocator_type& alloc) const;
+
+      /// Gives the value, which shares a leaked node with the value it was
+      /// copied from, copies of its own of every leaked node in its tree.
+      void unshare_leaked();
+
+      /// Drops the reference to the heap payload, if any. Trees are freed
+      /// iteratively, without recursion.
+      void release();
+
+      /// Drops the reference to the heap payload and leaves the value null.
+      /// If this was the last reference to an array or object, its nested
+      /// arrays and objects are first moved to pending, so a tree can be
+      /// torn down without recursion. Returns true if a node was freed.
+      template <typename TStack>
+      bool release_shallow(TStack& pending);
+
+      /// Frees the payload, which must have no other references, moving
+      /// nested arrays and objects to pending.
+      template <typename TStack>
+      void free_node(TStack& pending);
+
+      template <typename TValue>
+      friend class basic_json_reclaimer;
+
+      template <typename TValue>
+      friend struct basic_json_builder;
+
+      typename TLayout::storage st;
+   };
+
+   /// JSON value using the default 16 byte layout.
+   typedef basic_json_value<> json_value;
+
+   /// JSON value using the 8 byte NaN boxed layout, halving the size of
+   /// arrays at the cost of shorter inline strings.
+   typedef basic_json_value<json_nan_boxed_layout> json_compact_value;
+
+}
+
+namespace boost
+{
+   namespace container
+   {
+      /// Copies of a basic_json_value share its payload, so containers must
+      /// not pass their allocator when copying elements, which would make a
+      /// deep copy through the allocator extended copy constructor.
+      template <typename TLayout, typename TObjects, typename TAllocator, typename TOtherAllocator>
+      struct uses_allocator<adhd::basic_json_value<TLayout, TObjects, TAllocator>, TOtherAllocator>
+      {
+         static const bool value = false;
+      };
+   }
+}
+
+namespace adhd
+{
+   namespace pmr
+   {
+      /// JSON value allocating its strings, arrays and objects from a
+      /// boost::container::pmr::memory_resource, for instance a
+      /// monotonic_buffer_resource freeing a whole document at once.
+      typedef basic_json_value<json_tagged_layout, json_adaptive_objects<>, boost::container::pmr::polymorphic_allocator<char> > json_value;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   const basic_json_value<TLayout, TObjects, TAllocator> basic_json_value<TLayout, TObjects, TAllocator>::null;
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   basic_json_value<TLayout, TObjects, TAllocator>::~basic_json_value()
+   {
+      release();
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   void basic_json_value<TLayout, TObjects, TAllocator>::release()
+   {
+      if (!st.has_pointer() || !node()->release())
+         return;
+
+      if (st.type() == detail::variant_type_string)
+      {
+         detail::json_delete_node(static_cast<string_node*>(node()));
+         return;
+      }
+
+      detail::json_stack<basic_json_value, 16> pending;
+      free_node(pending);
+      while (!pending.empty())
+      {
+         basic_json_value child;
+         child.swap(pending.back());
+         pending.pop_back();
+         child.release_shallow(pending);
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   template <typename TStack>
+   bool basic_json_value<TLayout, TObjects, TAllocator>::release_shallow(TStack& pending)
+   {
+      const bool last = st.has_pointer() && node()->release();
+      if (last)
+         free_node(pending);
+
+      st.set_null();
+      return last;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   template <typename TStack>
+   void basic_json_value<TLayout, TObjects, TAllocator>::free_node(TStack& pending)
+   {
+      // No other reference exists, so the children may be moved out even
+      // through the const iterators of the object storage. Strings are
+      // left to be freed with the node, they have no children.
+      if (st.has_raw_pointer())
+      {
+         raw_node* n = static_cast<raw_node*>(node());
+         if (value_node* p = n->parsed.load(boost::memory_order_acquire))
+         {
+            pending.push_back(basic_json_value());
+            pending.back().swap(p->data);
+         }
+
+         detail::json_delete_node(n);
+         return;
+      }
+
+      switch (st.type())
+      {
+      case detail::variant_type_string:
+         detail::json_delete_node(static_cast<string_node*>(node()));
+         break;
+      case detail::variant_type_array:
+         if (st.has_packed_pointer())
+         {
+            detail::json_delete_node(static_cast<packed_node*>(node()));
+         }
+         else
+         {
+            array_node* n = static_cast<array_node*>(node());
+            for (typename array_type::iterator i = n->data.begin(), e = n->data.end(); i != e; ++i)
+            {
+               if (i->is_array() || i->is_object())
+               {
+                  pending.push_back(basic_json_value());
+                  pending.back().swap(*i);
+               }
+            }
+
+            detail::json_delete_node(n);
+         }
+         break;
+      case detail::variant_type_object:
+         {
+            object_node* n = static_cast<object_node*>(node());
+            for (typename object_type::iterator i = n->data.begin(), e = n->data.end(); i != e; ++i)
+            {
+               if (i->second.is_array() || i->second.is_object())
+               {
+                  pending.push_back(basic_json_value());
+                  pending.back().swap(i->second);
+               }
+            }
+
+            detail::json_delete_node(n);
+         }
+         break;
+      default:
+         break;
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   basic_json_value<TLayout, TObjects, TAllocator>::basic_json_value(const basic_json_value& rhs, const allocator_type& alloc)
+      : st(rhs.st)
+   {
+      if (st.has_pointer())
+         node()->add_ref();
+
+      // Starting from a shallow copy, every payload still shared with rhs
+      // is replaced by a copy allocated with alloc. The payloads being
+      // replaced stay alive through rhs while they are copied.
+      try
+      {
+         detail::json_stack<basic_json_value*, 16> pending;
+         pending.push_back(this);
+         while (!pending.empty())
+         {
+            basic_json_value& v = *pending.back();
+            pending.pop_back();
+
+            basic_json_value copy;
+            if (v.st.has_raw_pointer())
+            {
+               raw_node* n = detail::json_new_node<raw_node>(alloc, static_cast<const raw_node*>(v.node())->data);
+               copy.st.set_raw_pointer(v.st.type(), static_cast<detail::json_node_base*>(n));
+               v.swap(copy);
+               continue;
+            }
+
+            switch (v.st.type())
+            {
+            case detail::variant_type_string:
+               if (v.st.has_pointer())
+                  copy.init_string(v.long_string().data(), v.long_string().size(), alloc);
+               else
+                  copy.st = v.st;
+               v.swap(copy);
+               break;
+            case detail::variant_type_array:
+               if (v.st.has_packed_pointer())
+               {
+                  packed_node* n = detail::json_new_node<packed_node>(alloc, v.numbers());
+                  copy.st.set_packed_pointer(static_cast<detail::json_node_base*>(n));
+                  v.swap(copy);
+               }
+               else
+               {
+                  array_node* n = static_cast<array_node*>(v.new_shallow_node(alloc));
+                  copy.st.set_pointer(detail::variant_type_array, static_cast<detail::json_node_base*>(n));
+                  v.swap(copy);
+
+                  // Pushed last to first, so that the children are copied,
+                  // and laid out in memory, in document order.
+                  for (typename array_type::reverse_iterator i = n->data.rbegin(), e = n->data.rend(); i != e; ++i)
+                  {
+                     if (i->st.has_pointer())
+                        pending.push_back(&*i);
+                  }
+               }
+               break;
+            case detail::variant_type_object:
+               {
+                  object_node* n = static_cast<object_node*>(v.new_shallow_node(alloc));
+                  copy.st.set_pointer(detail::variant_type_object, static_cast<detail::json_node_base*>(n));
+                  v.swap(copy);
+                  typedef std::reverse_iterator<typename object_type::iterator> reverse_iterator;
+                  for (reverse_iterator i(n->data.end()), e(n->data.begin()); i != e; ++i)
+                  {
+                     basic_json_value& child = (*i).second;
+                     if (child.st.has_pointer())
+                        pending.push_back(&child);
+                  }
+               }
+               break;
+            default:
+               break;
+            }
+         }
+      }
+      catch (...)
+      {
+         release();
+         throw;
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   basic_json_value<TLayout, TObjects, TAllocator>::basic_json_value(const json_packed_array& val, const allocator_type& alloc)
+   {
+      packed_node* n = detail::json_new_node<packed_node>(alloc);
+      try
+      {
+         n->data.assign(val.first, val.last);
+      }
+      catch (...)
+      {
+         detail::json_delete_node(n);
+         throw;
+      }
+
+      st.set_packed_pointer(static_cast<detail::json_node_base*>(n));
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   basic_json_value<TLayout, TObjects, TAllocator>::basic_json_value(const json_raw& val, const allocator_type& alloc)
+   {
+      // The text is kept without surrounding whitespace, and with no
+      // embedded null character, which would end it for the parser.
+      const char* first = val.text.data();
+      const char* last = first + val.text.size();
+      while (first != last && detail::json_isspace(*first))
+         ++first;
+      while (last != first && detail::json_isspace(last[-1]))
+         --last;
+      if (std::memchr(first, '\0', last - first))
+         throw json_parse_exception("unexpected null character");
+
+      raw_node* n = detail::json_new_node<raw_node>(alloc);
+      try
+      {
+         n->data.assign(first, last);
+         detail::json_validate_raw(n->data.c_str());
+      }
+      catch (...)
+      {
+         detail::json_delete_node(n);
+         throw;
+      }
+
+      st.set_raw_pointer(*first == '{' ? detail::variant_type_object : detail::variant_type_array, static_cast<detail::json_node_base*>(n));
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   const basic_json_value<TLayout, TObjects, TAllocator>& basic_json_value<TLayout, TObjects, TAllocator>::raw_value() const
+   {
+      const raw_node* r = static_cast<const raw_node*>(node());
+      value_node* p = r->parsed.load(boost::memory_order_acquire);
+      if (!p)
+      {
+         // Threads racing to parse the text keep the first result published.
+         value_node* expected = 0;
+         p = detail::json_new_node<value_node>(r->alloc);
+         try
+         {
+            detail::json_parse_raw(r->data.c_str(), p->data, r->alloc);
+         }
+         catch (...)
+         {
+            detail::json_delete_node(p);
+            throw;
+         }
+
+         if (!r->parsed.compare_exchange_strong(expected, p, boost::memory_order_acq_rel, boost::memory_order_acquire))
+         {
+            detail::json_delete_node(p);
+            p = expected;
+         }
+      }
+
+      return p->data;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   typename basic_json_value<TLayout, TObjects, TAllocator>::array_type& basic_json_value<TLayout, TObjects, TAllocator>::mutable_array()
+   {
+      if (st.has_raw_pointer())
+         unraw();
+
+      if (st.has_packed_pointer())
+      {
+         // Elements written may be other than numbers.
+         array_node* n = new_unpacked_node(*static_cast<const packed_node*>(node()));
+         release();
+         st.set_pointer(detail::variant_type_array, static_cast<detail::json_node_base*>(n));
+         return n->data;
+      }
+
+      array_node* n = static_cast<array_node*>(node());
+      if (!n->unique())
+      {
+         n = detail::json_new_node<array_node>(n->alloc, n->data);
+         release();
+         st.set_pointer(detail::variant_type_array, static_cast<detail::json_node_base*>(n));
+      }
+
+      n->modified();
+      return n->data;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   typename basic_json_value<TLayout, TObjects, TAllocator>::object_type& basic_json_value<TLayout, TObjects, TAllocator>::mutable_object()
+   {
+      if (st.has_raw_pointer())
+         unraw();
+
+      object_node* n = static_cast<object_node*>(node());
+      if (!n->unique())
+      {
+         n = detail::json_new_node<object_node>(n->alloc, n->data);
+         release();
+         st.set_pointer(detail::variant_type_object, static_cast<detail::json_node_base*>(n));
+      }
+
+      n->modified();
+      return n->data;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   detail::json_node_base* basic_json_value<TLayout, TObjects, TAllocator>::new_shallow_node(const allocator_type& alloc) const
+   {
+      // The flags of the leaked children are lifted while they are copied,
+      // so that they are shared like the others.
+      detail::json_stack<bool*, 16> lifted;
+      for (accept_frame children(this); children.is_array ? children.element != children.elements_end : children.member != children.members_end; )
+      {
+         const basic_json_value& child = children.is_array ? *children.element++ : (children.member++)->second;
+         if (child.is_leaked())
+         {
+            bool& leaked = child.is_array() ? static_cast<array_node*>(child.node())->leaked : static_cast<object_node*>(child.node())->leaked;
+            lifted.push_back(&leaked);
+            leaked = false;
+         }
+      }
+
+      detail::json_node_base* n = 0;
+      try
+      {
+         if (is_array())
+            n = detail::json_new_node<array_node>(alloc, array());
+         else
+            n = detail::json_new_node<object_node>(alloc, object());
+      }
+      catch (...)
+      {
+         for (; !lifted.empty(); lifted.pop_back())
+            *lifted.back() = true;
+         throw;
+      }
+
+      for (; !lifted.empty(); lifted.pop_back())
+         *lifted.back() = true;
+
+      return n;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   void basic_json_value<TLayout, TObjects, TAllocator>::unshare_leaked()
+   {
+      try
+      {
+         detail::json_stack<basic_json_value*, 16> pending;
+         pending.push_back(this);
+         while (!pending.empty())
+         {
+            basic_json_value& v = *pending.back();
+            pending.pop_back();
+
+            basic_json_value copy;
+            copy.st.set_pointer(v.st.type(), v.new_shallow_node(v.get_allocator()));
+            v.swap(copy);
+
+            if (v.is_array())
+            {
+               array_type& a = static_cast<array_node*>(v.node())->data;
+               for (typename array_type::reverse_iterator i = a.rbegin(), e = a.rend(); i != e; ++i)
+               {
+                  if (i->is_leaked())
+                     pending.push_back(&*i);
+               }
+            }
+            else
+            {
+               object_type& o = static_cast<object_node*>(v.node())->data;
+               typedef std::reverse_iterator<typename object_type::iterator> reverse_iterator;
+               for (reverse_iterator i(o.end()), e(o.begin()); i != e; ++i)
+               {
+                  basic_json_value& child = (*i).second;
+                  if (child.is_leaked())
+                     pending.push_back(&child);
+               }
+            }
+         }
+      }
+      catch (...)
+      {
+         release();
+         throw;
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   inline typename basic_json_value<TLayout, TObjects, TAllocator>::shallow_equality basic_json_value<TLayout, TObjects, TAllocator>::equal_shallow(const basic_json_value& lhs, const basic_json_value& rhs)
+   {
+      if (lhs.st.type() != rhs.st.type())
+         return shallow_unequal;
+
+      if (lhs.st.has_pointer() && rhs.st.has_pointer() && lhs.st.pointer() == rhs.st.pointer())
+         return shallow_equal;
+
+      switch (lhs.st.type())
+      {
+      case detail::variant_type_string:
+         return lhs.get_string_ref() == rhs.get_string_ref() ? shallow_equal : shallow_unequal;
+      case detail::variant_type_number:
+         return (detail::json_isnan(lhs.st.number()) && detail::json_isnan(rhs.st.number())) || lhs.st.number() == rhs.st.number() ? shallow_equal : shallow_unequal;
+      case detail::variant_type_bool:
+         return lhs.st.boolean() == rhs.st.boolean() ? shallow_equal : shallow_unequal;
+      case detail::variant_type_array:
+         if (lhs.get_length() != rhs.get_length())
+            return shallow_unequal;
+         break;
+      case detail::variant_type_object:
+         if (lhs.object().size() != rhs.object().size())
+            return shallow_unequal;
+         break;
+      default:
+         return shallow_equal;
+      }
+
+      // Trees already hashed are told apart without walking them.
+      const size_t lhs_hash = lhs.cached_hash();
+      const size_t rhs_hash = rhs.cached_hash();
+      if (lhs_hash != 0 && rhs_hash != 0 && lhs_hash != rhs_hash)
+         return shallow_unequal;
+
+      // Raw values compare as the array or object they hold, which is
+      // compared in a separate walk as it holds no raw values itself.
+      if (lhs.st.has_raw_pointer() || rhs.st.has_raw_pointer())
+         return lhs.without_raw() == rhs.without_raw() ? shallow_equal : shallow_unequal;
+
+      if (lhs.st.has_packed_pointer() || rhs.st.has_packed_pointer())
+         return compare_packed(lhs, rhs) == 0 ? shallow_equal : shallow_unequal;
+
+      return shallow_descend;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   bool basic_json_value<TLayout, TObjects, TAllocator>::equal_recursive(const basic_json_value& rhs, size_t depth) const
+   {
+      const shallow_equality shallow = equal_shallow(*this, rhs);
+      if (shallow != shallow_descend)
+         return shallow == shallow_equal;
+
+      if (depth == 0)
+         return equal_iterative(rhs);
+
+      if (is_object())
+         return objects_equal(object(), rhs.object(), depth - 1);
+
+      for (typename array_type::const_iterator i = array().begin(), j = rhs.array().begin(), e = array().end(); i != e; ++i, ++j)
+      {
+         if (!i->equal_recursive(*j, depth - 1))
+            return false;
+      }
+
+      return true;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   bool basic_json_value<TLayout, TObjects, TAllocator>::objects_equal(const object_type& lhs, const object_type& rhs, size_t depth)
+   {
+      if (lhs.ordered() && rhs.ordered())
+      {
+         for (typename object_type::const_iterator i = lhs.begin(), j = rhs.begin(), e = lhs.end(); i != e; ++i, ++j)
+         {
+            if (i->first != j->first || !i->second.equal_recursive(j->second, depth))
+               return false;
+         }
+
+         return true;
+      }
+
+      for (typename object_type::const_iterator i = lhs.begin(), e = lhs.end(); i != e; ++i)
+      {
+         const basic_json_value* child = rhs.find(i->first);
+         if (!child || !i->second.equal_recursive(*child, depth))
+            return false;
+      }
+
+      return true;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   bool basic_json_value<TLayout, TObjects, TAllocator>::equal_iterative(const basic_json_value& rhs) const
+   {
+      detail::json_stack<compare_frame, 16> stack;
+      stack.push_back(compare_frame(this, &rhs));
+      while (!stack.empty())
+      {
+         // Compares children in place, stopping at the next pair of arrays or objects.
+         compare_frame& f = stack.back();
+         const basic_json_value* lhs_child = 0;
+         const basic_json_value* rhs_child = 0;
+         if (f.is_array)
+         {
+            while (f.lhs_element != f.lhs_elements_end)
+            {
+               const basic_json_value& l = *f.lhs_element++;
+               const basic_json_value& r = *f.rhs_element++;
+               const shallow_equality e = equal_shallow(l, r);
+               if (e == shallow_unequal)
+                  return false;
+
+               if (e == shallow_descend)
+               {
+                  lhs_child = &l;
+                  rhs_child = &r;
+                  break;
+               }
+            }
+         }
+         else
+         {
+            while (f.lhs_member != f.lhs_members_end)
+            {
+               const detail::json_member_ref<const basic_json_value> l = *f.lhs_member++;
+               const basic_json_value* r;
+               if (f.sorted)
+               {
+                  r = f.rhs_object->find(boost::string_ref(l.first.data(), l.first.size()));
+                  if (!r)
+                     return false;
+               }
+               else
+               {
+                  const detail::json_member_ref<const basic_json_value> m = *f.rhs_member++;
+                  if (l.first != m.first)
+                     return false;
+                  r = &m.second;
+               }
+
+               const shallow_equality e = equal_shallow(l.second, *r);
+               if (e == shallow_unequal)
+                  return false;
+
+               if (e == shallow_descend)
+               {
+                  lhs_child = &l.second;
+                  rhs_child = r;
+                  break;
+               }
+            }
+         }
+
+         if (lhs_child)
+            stack.push_back(compare_frame(lhs_child, rhs_child));
+         else
+         {
+            stack.pop_back();
+         }
+      }
+
+      return true;
+   }
+
+   namespace detail
+   {
+      /// Orders object members, given by iterators, by name.
+      template <typename TIterator>
+      struct json_member_name_less
+      {
+         bool operator()(const TIterator& lhs, const TIterator& rhs) const
+         {
+            return lhs->first < rhs->first;
+         }
+      };
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   bool basic_json_value<TLayout, TObjects, TAllocator>::operator<(const basic_json_value& rhs) const
+   {
+      return compare(rhs, recursion_depth) < 0;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   inline int basic_json_value<TLayout, TObjects, TAllocator>::compare_shallow(const basic_json_value& lhs, const basic_json_value& rhs, bool& descend)
+   {
+      descend = false;
+      if (lhs.st.type() != rhs.st.type())
+         return lhs.st.type() < rhs.st.type() ? -1 : 1;
+
+      if (lhs.st.has_pointer() && rhs.st.has_pointer() && lhs.st.pointer() == rhs.st.pointer())
+         return 0;
+
+      switch (lhs.st.type())
+      {
+      case detail::variant_type_string:
+         return lhs.get_string_ref().compare(rhs.get_string_ref());
+      case detail::variant_type_number:
+         return compare_numbers(lhs.st.number(), rhs.st.number());
+      case detail::variant_type_bool:
+         return lhs.st.boolean() == rhs.st.boolean() ? 0 : lhs.st.boolean() ? 1 : -1;
+      case detail::variant_type_array:
+      case detail::variant_type_object:
+         if (lhs.st.has_raw_pointer() || rhs.st.has_raw_pointer())
+            return lhs.without_raw().compare(rhs.without_raw(), recursion_depth);
+
+         if (lhs.st.has_packed_pointer() || rhs.st.has_packed_pointer())
+            return compare_packed(lhs, rhs);
+
+         descend = true;
+         return 0;
+      default:
+         return 0;
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   int basic_json_value<TLayout, TObjects, TAllocator>::compare_packed(const basic_json_value& lhs, const basic_json_value& rhs)
+   {
+      const size_t lhs_length = lhs.get_length();
+      const size_t rhs_length = rhs.get_length();
+      const size_t length = std::min(lhs_length, rhs_length);
+      if (lhs.st.has_packed_pointer() && rhs.st.has_packed_pointer())
+      {
+         for (size_t i = 0; i != length; ++i)
+         {
+            const int result = compare_numbers(lhs.numbers()[i], rhs.numbers()[i]);
+            if (result != 0)
+               return result;
+         }
+      }
+      else
+      {
+         // One side holds only numbers, so a pair is never two containers.
+         basic_json_value lhs_scratch;
+         basic_json_value rhs_scratch;
+         bool descend;
+         for (size_t i = 0; i != length; ++i)
+         {
+            const int result = compare_shallow(lhs.element(i, lhs_scratch), rhs.element(i, rhs_scratch), descend);
+            if (result != 0)
+               return result;
+         }
+      }
+
+      // A prefix compares less than the longer sequence.
+      return lhs_length == rhs_length ? 0 : lhs_length < rhs_length ? -1 : 1;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   int basic_json_value<TLayout, TObjects, TAllocator>::compare(const basic_json_value& rhs, size_t depth) const
+   {
+      // Values are ordered by type, then by content. Arrays compare their
+      // elements lexicographically and objects their members, ordered by
+      // name, by name and then by value. The first difference found by a
+      // walk over both trees in step therefore decides.
+      bool descend;
+      const int result = compare_shallow(*this, rhs, descend);
+      if (!descend)
+         return result;
+
+      // Objects not ordered by name are sorted by the iterative version.
+      if (depth == 0 || (is_object() && (!object().ordered() || !rhs.object().ordered())))
+         return compare_iterative(rhs);
+
+      if (is_array())
+      {
+         typename array_type::const_iterator l = array().begin();
+         typename array_type::const_iterator r = rhs.array().begin();
+         const typename array_type::const_iterator lhs_end = array().end();
+         const typename array_type::const_iterator rhs_end = rhs.array().end();
+         for (; l != lhs_end && r != rhs_end; ++l, ++r)
+         {
+            const int child = l->compare(*r, depth - 1);
+            if (child != 0)
+               return child;
+         }
+
+         // A prefix compares less than the longer sequence.
+         return l == lhs_end ? r == rhs_end ? 0 : -1 : 1;
+      }
+
+      typename object_type::const_iterator l = object().begin();
+      typename object_type::const_iterator r = rhs.object().begin();
+      const typename object_type::const_iterator lhs_end = object().end();
+      const typename object_type::const_iterator rhs_end = rhs.object().end();
+      for (; l != lhs_end && r != rhs_end; ++l, ++r)
+      {
+         int child = l->first.compare(r->first);
+         if (child == 0)
+            child = l->second.compare(r->second, depth - 1);
+
+         if (child != 0)
+            return child;
+      }
+
+      return l == lhs_end ? r == rhs_end ? 0 : -1 : 1;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   int basic_json_value<TLayout, TObjects, TAllocator>::compare_iterative(const basic_json_value& rhs) const
+   {
+      bool descend;
+      detail::json_stack<compare_frame, 16> stack;
+      std::vector<const_member_iterator> members;
+      const basic_json_value* lhs_child = this;
+      const basic_json_value* rhs_child = &rhs;
+      for (;;)
+      {
+         if (lhs_child)
+         {
+            stack.push_back(compare_frame(lhs_child, rhs_child));
+            compare_frame& f = stack.back();
+            if (f.sorted)
+            {
+               f.lhs_sorted = members.size();
+               for (const_member_iterator i = f.lhs_member; i != f.lhs_members_end; ++i)
+                  members.push_back(i);
+               f.lhs_sorted_end = f.rhs_sorted = members.size();
+               for (const_member_iterator i = f.rhs_member; i != f.rhs_members_end; ++i)
+                  members.push_back(i);
+               f.rhs_sorted_end = members.size();
+               std::sort(members.begin() + f.lhs_sorted, members.begin() + f.lhs_sorted_end, detail::json_member_name_less<const_member_iterator>());
+               std::sort(members.begin() + f.rhs_sorted, members.end(), detail::json_member_name_less<const_member_iterator>());
+            }
+         }
+
+         // Compares children in place, stopping at the next pair of arrays or objects.
+         compare_frame& f = stack.back();
+         lhs_child = 0;
+         bool lhs_done;
+         bool rhs_done;
+         if (f.is_array)
+         {
+            for (;;)
+            {
+               lhs_done = f.lhs_element == f.lhs_elements_end;
+               rhs_done = f.rhs_element == f.rhs_elements_end;
+               if (lhs_done || rhs_done)
+                  break;
+
+               const basic_json_value& l = *f.lhs_element++;
+               const basic_json_value& r = *f.rhs_element++;
+               const int result = compare_shallow(l, r, descend);
+               if (result != 0)
+                  return result;
+
+               if (descend)
+               {
+                  lhs_child = &l;
+                  rhs_child = &r;
+                  break;
+               }
+            }
+         }
+         else
+         {
+            for (;;)
+            {
+               const_member_iterator l;
+               const_member_iterator r;
+               if (f.sorted)
+               {
+                  lhs_done = f.lhs_sorted == f.lhs_sorted_end;
+                  rhs_done = f.rhs_sorted == f.rhs_sorted_end;
+                  if (lhs_done || rhs_done)
+                     break;
+
+                  l = members[f.lhs_sorted++];
+                  r = members[f.rhs_sorted++];
+               }
+               else
+               {
+                  lhs_done = f.lhs_member == f.lhs_members_end;
+                  rhs_done = f.rhs_member == f.rhs_members_end;
+                  if (lhs_done || rhs_done)
+                     break;
+
+                  l = f.lhs_member++;
+                  r = f.rhs_member++;
+               }
+
+               int result = l->first.compare(r->first);
+               if (result != 0)
+                  return result;
+
+               result = compare_shallow(l->second, r->second, descend);
+               if (result != 0)
+                  return result;
+
+               if (descend)
+               {
+                  lhs_child = &l->second;
+                  rhs_child = &r->second;
+                  break;
+               }
+            }
+         }
+
+         if (!lhs_child)
+         {
+            // A prefix compares less than the longer sequence.
+            if (lhs_done != rhs_done)
+               return lhs_done ? -1 : 1;
+
+            if (f.sorted)
+               members.resize(f.lhs_sorted);
+
+            stack.pop_back();
+            if (stack.empty())
+               return 0;
+         }
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   size_t basic_json_value<TLayout, TObjects, TAllocator>::hash() const
+   {
+      if (!is_container() || cached_hash() != 0)
+         return hash_shallow();
+
+      // Hashes the nested arrays and objects in post order, folding the
+      // hash of every child into its parent. The hashes are cached, but
+      // for leaked arrays and objects, whose hashes are computed anew.
+      detail::json_stack<hash_frame, 16> stack;
+      stack.push_back(hash_frame(this));
+      for (;;)
+      {
+         hash_frame& f = stack.back();
+         const basic_json_value* child = 0;
+         if (f.children.is_array)
+         {
+            while (f.children.element != f.children.elements_end && !child)
+            {
+               const basic_json_value& v = *f.children.element++;
+               if (v.is_container() && v.cached_hash() == 0)
+                  child = &v;
+               else
+                  f.add(v.hash_shallow());
+            }
+         }
+         else
+         {
+            while (f.children.member != f.children.members_end && !child)
+            {
+               const boost::string_ref name = f.children.member->first;
+               const basic_json_value& v = (f.children.member++)->second;
+               f.name = boost::hash_range(name.begin(), name.end());
+               if (v.is_container() && v.cached_hash() == 0)
+                  child = &v;
+               else
+                  f.add(v.hash_shallow());
+            }
+         }
+
+         if (child)
+         {
+            stack.push_back(hash_frame(child));
+            continue;
+         }
+
+         const size_t result = f.result();
+         const basic_json_value& v = *f.value;
+         if (!v.is_leaked())
+         {
+            if (v.is_array())
+               static_cast<const array_node*>(v.node())->hash.store(result, boost::memory_order_relaxed);
+            else
+               static_cast<const object_node*>(v.node())->hash.store(result, boost::memory_order_relaxed);
+         }
+
+         stack.pop_back();
+         if (stack.empty())
+            return result;
+
+         stack.back().add(result);
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   size_t basic_json_value<TLayout, TObjects, TAllocator>::hash_shallow() const
+   {
+      // Raw values hash as the array or object they hold.
+      if (st.has_raw_pointer())
+         return raw_value().hash();
+
+      size_t seed = st.type();
+      switch (st.type())
+      {
+      case detail::variant_type_string:
+         {
+            const boost::string_ref str = get_string_ref();
+            boost::hash_combine(seed, boost::hash_range(str.begin(), str.end()));
+         }
+         return seed;
+      case detail::variant_type_number:
+         // Equal for 0 and -0 and for every NaN, as operator== requires.
+         boost::hash_combine(seed, boost::hash_value(st.number()));
+         return seed;
+      case detail::variant_type_bool:
+         boost::hash_combine(seed, st.boolean());
+         return seed;
+      case detail::variant_type_array:
+         if (st.has_packed_pointer())
+         {
+            const packed_node* n = static_cast<const packed_node*>(node());
+            size_t result = n->hash.load(boost::memory_order_relaxed);
+            if (result != 0)
+               return result;
+
+            // Elements are hashed as the number values they would expand to.
+            boost::hash_combine(seed, n->data.size());
+            for (typename number_vector::const_iterator i = n->data.begin(), e = n->data.end(); i != e; ++i)
+            {
+               size_t element = detail::variant_type_number;
+               boost::hash_combine(element, boost::hash_value(*i));
+               boost::hash_combine(seed, element);
+            }
+
+            result = seed != 0 ? seed : 1;
+            n->hash.store(result, boost::memory_order_relaxed);
+            return result;
+         }
+
+         // Arrays and objects are hashed by hash, see hash_frame.
+         return cached_hash();
+      case detail::variant_type_object:
+         return cached_hash();
+      default:
+         return seed;
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   void basic_json_value<TLayout, TObjects, TAllocator>::init_string(const char* str, size_t length, const allocator_type& alloc)
+   {
+      if (!st.set_short_string(str, length))
+      {
+         string_node* n = detail::json_new_node<string_node>(alloc);
+         try
+         {
+            n->data.assign(str, length);
+         }
+         catch (...)
+         {
+            detail::json_delete_node(n);
+            throw;
+         }
+
+         st.set_pointer(detail::variant_type_string, static_cast<detail::json_node_base*>(n));
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   const basic_json_value<TLayout, TObjects, TAllocator>& basic_json_value<TLayout, TObjects, TAllocator>::get_child(size_t i) const
+   {
+      assert(is_null() || is_array());
+      if (!is_array())
+      {
+         return null;
+      }
+
+      if (i >= get_length())
+      {
+         return null;
+      }
+
+      return array()[i];
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   basic_json_value<TLayout, TObjects, TAllocator>& basic_json_value<TLayout, TObjects, TAllocator>::put_child(size_t i)
+   {
+      assert(is_null() || is_array());
+      if (!is_array())
+      {
+         basic_json_value(json_array()).swap(*this);
+      }
+
+      array_type& a = leaked_array();
+      if (i >= a.size())
+      {
+         a.resize(i + 1);
+      }
+
+      return a[i];
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   void basic_json_value<TLayout, TObjects, TAllocator>::set_length(size_t length)
+   {
+      assert(is_null() || is_array());
+      if (!is_array())
+      {
+         basic_json_value(json_array()).swap(*this);
+      }
+
+      mutable_array().resize(length);
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   void basic_json_value<TLayout, TObjects, TAllocator>::reserve(size_t length)
+   {
+      assert(is_null() || is_array());
+      if (!is_array())
+      {
+         basic_json_value(json_array()).swap(*this);
+      }
+
+      mutable_array().reserve(length);
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   template <typename TIterator>
+   void basic_json_value<TLayout, TObjects, TAllocator>::append_children(TIterator first, TIterator last)
+   {
+      assert(is_null() || is_array());
+      if (!is_array())
+      {
+         basic_json_value(json_array()).swap(*this);
+      }
+
+      array_type& a = mutable_array();
+      for (; first != last; ++first)
+      {
+         a.push_back(basic_json_value(*first));
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   bool basic_json_value<TLayout, TObjects, TAllocator>::pack()
+   {
+      if (!is_array())
+      {
+         return false;
+      }
+
+      if (st.has_raw_pointer())
+      {
+         unraw();
+      }
+
+      if (st.has_packed_pointer())
+      {
+         return true;
+      }
+
+      const array_node* n = static_cast<const array_node*>(node());
+      for (typename array_type::const_iterator i = n->data.begin(), e = n->data.end(); i != e; ++i)
+      {
+         if (!i->is_number())
+         {
+            return false;
+         }
+      }
+
+      packed_node* p = detail::json_new_node<packed_node>(n->alloc);
+      try
+      {
+         p->data.reserve(n->data.size());
+         for (typename array_type::const_iterator i = n->data.begin(), e = n->data.end(); i != e; ++i)
+         {
+            p->data.push_back(i->st.number());
+         }
+      }
+      catch (...)
+      {
+         detail::json_delete_node(p);
+         throw;
+      }
+
+      // The elements hash the same either way.
+      p->hash.store(cached_hash(), boost::memory_order_relaxed);
+      release();
+      st.set_packed_pointer(static_cast<detail::json_node_base*>(p));
+      return true;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   const typename basic_json_value<TLayout, TObjects, TAllocator>::array_type& basic_json_value<TLayout, TObjects, TAllocator>::packed_elements() const
+   {
+      const packed_node* p = static_cast<const packed_node*>(node());
+      array_node* n = p->elements.load(boost::memory_order_acquire);
+      if (!n)
+      {
+         // Threads racing to expand the elements keep the first expansion published.
+         array_node* expected = 0;
+         n = new_unpacked_node(*p);
+         if (!p->elements.compare_exchange_strong(expected, n, boost::memory_order_acq_rel, boost::memory_order_acquire))
+         {
+            detail::json_delete_node(n);
+            n = expected;
+         }
+      }
+
+      return n->data;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   typename basic_json_value<TLayout, TObjects, TAllocator>::array_node* basic_json_value<TLayout, TObjects, TAllocator>::new_unpacked_node(const packed_node& packed)
+   {
+      array_node* n = detail::json_new_node<array_node>(packed.alloc);
+      try
+      {
+         n->data.reserve(packed.data.size());
+         for (typename number_vector::const_iterator i = packed.data.begin(), e = packed.data.end(); i != e; ++i)
+         {
+            n->data.push_back(basic_json_value(*i));
+         }
+      }
+      catch (...)
+      {
+         detail::json_delete_node(n);
+         throw;
+      }
+
+      return n;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   const basic_json_value<TLayout, TObjects, TAllocator>& basic_json_value<TLayout, TObjects, TAllocator>::get_child(boost::string_ref name) const
+   {
+      assert(is_null() || is_object());
+      const basic_json_value* child = find_child(name);
+      if (!child)
+      {
+         return null;
+      }
+
+      return *child;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   void basic_json_value<TLayout, TObjects, TAllocator>::get_children(const json_key_set& keys, const basic_json_value** children) const
+   {
+      assert(is_null() || is_object());
+      if (!is_object())
+      {
+         std::fill(children, children + keys.size(), &null);
+         return;
+      }
+
+      object().find_all(keys, children);
+      for (size_t k = 0; k != keys.size(); ++k)
+      {
+         if (!children[k])
+         {
+            children[k] = &null;
+         }
+      }
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   basic_json_value<TLayout, TObjects, TAllocator>& basic_json_value<TLayout, TObjects, TAllocator>::put_child(boost::string_ref name)
+   {
+      assert(is_null() || is_object());
+      if (!is_object())
+      {
+         basic_json_value(json_object()).swap(*this);
+      }
+
+      return leaked_object().insert(name);
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   bool basic_json_value<TLayout, TObjects, TAllocator>::erase_child(boost::string_ref name)
+   {
+      assert(is_null() || is_object());
+      if (!is_object())
+      {
+         return false;
+      }
+
+      if (!object().find(name))
+      {
+         return false;
+      }
+
+      return mutable_object().erase(name);
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   std::string basic_json_value<TLayout, TObjects, TAllocator>::to_pretty_string(size_t indent_size) const
+   {
+      json_buffer buffer;
+      json_buffer_pretty_printer writer(buffer, indent_size);
+      accept(writer);
+      std::string str;
+      buffer.release(str);
+      return str;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   std::ostream& basic_json_value<TLayout, TObjects, TAllocator>::pretty_print(std::ostream& os, size_t indent_size) const
+   {
+      json_buffer buffer(os);
+      json_buffer_pretty_printer writer(buffer, indent_size);
+      accept(writer);
+      buffer.flush();
+      return os;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   std::string basic_json_value<TLayout, TObjects, TAllocator>::to_string() const
+   {
+      json_buffer buffer;
+      json_buffer_writer writer(buffer);
+      accept(writer);
+      std::string str;
+      buffer.release(str);
+      return str;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   std::string basic_json_value<TLayout, TObjects, TAllocator>::to_cached_string() const
+   {
+      json_buffer buffer;
+      json_buffer_writer writer(buffer);
+      detail::json_stack<cache_frame, 16> stack;
+      const basic_json_value* v = this;
+      for (;;)
+      {
+         // Output of v kept, counted against the array or object it is in.
+         const size_t start = buffer.size();
+         size_t kept = 0;
+         if (v->write_cached_output(buffer))
+         {
+            // Copied as kept.
+            kept = buffer.size() - start;
+         }
+         else if (v->st.has_packed_pointer())
+         {
+            v->accept_packed(writer);
+            if (v->keep_output(buffer, start, 0))
+               kept = buffer.size() - start;
+         }
+         else if (v->is_container())
+         {
+            json_put(buffer, v->is_array() ? '[' : '{');
+            stack.push_back(cache_frame(v, start));
+         }
+         else
+         {
+            v->accept_scalar(writer);
+         }
+
+         if (kept != 0 && !stack.empty())
+            stack.back().covered += kept;
+
+         // Closes finished arrays and objects, stopping at the next child.
+         v = 0;
+         while (!v && !stack.empty())
+         {
+            cache_frame& c = stack.back();
+            if (c.children.is_array ? c.children.element != c.children.elements_end : c.children.member != c.children.members_end)
+            {
+               if (!c.first)
+                  json_put(buffer, ',');
+               c.first = false;
+
+               if (c.children.is_array)
+               {
+                  v = &*c.children.element++;
+               }
+               else
+               {
+                  detail::json_visit_string(writer, c.children.member->first);
+                  json_put(buffer, ':');
+                  v = &(c.children.member++)->second;
+               }
+            }
+            else
+            {
+               json_put(buffer, c.children.is_array ? ']' : '}');
+
+               // Output not kept passes on what is kept within it. The
+               // output of this value is kept whatever its children keep,
+               // so that writing it again unchanged is a single copy.
+               const size_t covered = c.value != this ? c.covered : 0;
+               const size_t kept = c.value->keep_output(buffer, c.start, covered) ? buffer.size() - c.start : c.covered;
+               stack.pop_back();
+               if (!stack.empty())
+                  stack.back().covered += kept;
+            }
+         }
+
+         if (!v)
+            break;
+      }
+
+      std::string str;
+      buffer.release(str);
+      return str;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   bool basic_json_value<TLayout, TObjects, TAllocator>::keep_output(const json_buffer& buffer, size_t start, size_t covered) const
+   {
+      // Every output kept has at least half of its characters kept by no
+      // nested array or object, bounding the output kept at twice the
+      // output. Leaked arrays and objects may be written without dropping
+      // their output, so it is not kept.
+      const size_t length = buffer.size() - start;
+      if (length < output_cache_threshold || covered > length / 2 || is_leaked())
+         return false;
+
+      output_node* o = detail::json_new_node<output_node>(static_cast<const detail::json_allocated_node<TAllocator>*>(node())->alloc);
+      try
+      {
+         o->data.assign(buffer.data() + start, buffer.data() + start + length);
+      }
+      catch (...)
+      {
+         detail::json_delete_node(o);
+         throw;
+      }
+
+      // Threads racing to write the same node keep the first output published.
+      output_node* expected = 0;
+      if (!output_cache().compare_exchange_strong(expected, o, boost::memory_order_acq_rel, boost::memory_order_acquire))
+         detail::json_delete_node(o);
+
+      return true;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   size_t basic_json_value<TLayout, TObjects, TAllocator>::serialized_size() const
+   {
+      json_size_counter counter;
+      json_size_writer writer(counter);
+      accept(writer);
+      return counter.size;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   size_t basic_json_value<TLayout, TObjects, TAllocator>::pretty_serialized_size(size_t indent_size) const
+   {
+      json_size_counter counter;
+      json_size_pretty_printer writer(counter, indent_size);
+      accept(writer);
+      return counter.size;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   size_t basic_json_value<TLayout, TObjects, TAllocator>::serialize_into(char* data, size_t size) const
+   {
+      json_fixed_buffer buffer(data, size);
+      json_fixed_writer writer(buffer);
+      accept(writer);
+      return buffer.size;
+   }
+
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   size_t basic_json_value<TLayout, TObjects, TAllocator>::pretty_serialize_into(char* data, size_t size, size_t indent_size) const
+   {
+      json_fixed_buffer buffer(data, size);
+      json_fixed_pretty_printer writer(buffer, indent_size);
+      accept(writer);
+      return buffer.size;
+   }
+
+   /// Hash for boost::hash and Boost.Unordered.
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   size_t hash_value(const basic_json_value<TLayout, TObjects, TAllocator>& rhs)
+   {
+      return rhs.hash();
+   }
+
+   /// Outputs a JSON value to a stream in a compact way.
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   std::ostream& operator<<(std::ostream& os, const basic_json_value<TLayout, TObjects, TAllocator>& rhs)
+   {
+      json_buffer buffer(os);
+      json_buffer_writer writer(buffer);
+      rhs.accept(writer);
+      buffer.flush();
+      return os;
+   }
+}
+
+#if !defined(BOOST_NO_CXX11_HDR_FUNCTIONAL)
+namespace std
+{
+   /// Hash for the standard unordered containers.
+   template <typename TLayout, typename TObjects, typename TAllocator>
+   struct hash< adhd::basic_json_value<TLayout, TObjects, TAllocator> >
+   {
+      size_t operator()(const adhd::basic_json_value<TLayout, TObjects, TAllocator>& rhs) const
+      {
+         return rhs.hash();
+      }
+   };
+}
+#endif
+
+// Raw values are checked and parsed by json_parser.
+#include "json_parser.h"
 
 #endif
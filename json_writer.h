@@ -0,0 +1,493 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+#if !defined(ADHD_JSON_WRITER_H)
+#define ADHD_JSON_WRITER_H
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+#if !defined(ADHD_JSON_API)
+#  ifdef _WIN32
+#     if defined(ADHD_JSON_EXPORT)
+#        define ADHD_JSON_API __declspec(dllexport)
+#     elif defined(ADHD_JSON_IMPORT)
+#        define ADHD_JSON_API __declspec(dllimport)
+#     else
+#        define ADHD_JSON_API
+#     endif
+#  else
+#     define ADHD_JSON_API
+#  endif
+#endif
+
+namespace adhd
+{
+   /// Output buffer for the JSON writers, appending to a contiguous block
+   /// of characters with an inline bounds check rather than a call through
+   /// std::ostream for each token.
+   ///
+   /// By default the buffer grows to hold the whole output, see str() and
+   /// release(). Given a flush function, or a stream, the buffer holds at
+   /// most capacity characters and passes them on whenever it is full and
+   /// when flush() is called. Output still held when the buffer is
+   /// destroyed is discarded.
+   class ADHD_JSON_API json_buffer
+   {
+   public:
+      typedef void (*flush_function)(void* context, const char* data, size_t size);
+
+      json_buffer();
+
+      json_buffer(flush_function flush, void* context, size_t capacity = 4096);
+
+      explicit json_buffer(std::ostream& os, size_t capacity = 4096);
+
+      void put(char c)
+      {
+         if (cursor == limit)
+            reserve(1);
+
+         *cursor++ = c;
+      }
+
+      void write(const char* str, size_t length)
+      {
+         if (static_cast<size_t>(limit - cursor) < length)
+            reserve(length);
+
+         std::memcpy(cursor, str, length);
+         cursor += length;
+      }
+
+      /// Returns room for length characters at the end of the output,
+      /// which commit() then appends.
+      char* prepare(size_t length)
+      {
+         if (static_cast<size_t>(limit - cursor) < length)
+            reserve(length);
+
+         return cursor;
+      }
+
+      void commit(size_t length)
+      {
+         cursor += length;
+      }
+
+      /// Output held, which is all output unless there is a flush function.
+      const char* data() const
+      {
+         return storage.data();
+      }
+
+      size_t size() const
+      {
+         return cursor - first;
+      }
+
+      std::string str() const
+      {
+         return std::string(data(), size());
+      }
+
+      /// Moves the output held into str, leaving the buffer empty.
+      void release(std::string& str);
+
+      /// Passes the output held to the flush function, if any.
+      void flush();
+
+   private:
+      json_buffer(const json_buffer&);
+      json_buffer& operator=(const json_buffer&);
+
+      /// Makes room for length more characters, flushing or growing the storage.
+      void reserve(size_t length);
+
+      static void flush_to_stream(void* os, const char* data, size_t size);
+
+      std::string storage;
+      char* first;
+      char* cursor;
+      char* limit;
+      flush_function flush_to;
+      void* context;
+   };
+
+   /// Output for the JSON writers that only counts the characters written,
+   /// giving the exact length of the output without producing it.
+   struct json_size_counter
+   {
+      json_size_counter()
+         : size(0)
+      {
+      }
+
+      size_t size;
+   };
+
+   /// Output for the JSON writers into a caller provided block of
+   /// characters. Output beyond capacity is dropped, so data holds a
+   /// prefix of the output while size counts all of it, like snprintf.
+   struct json_fixed_buffer
+   {
+      json_fixed_buffer(char* data, size_t capacity)
+         : data(data)
+         , capacity(capacity)
+         , size(0)
+      {
+      }
+
+      /// Once a write does not fit size exceeds capacity, so no later
+      /// write fits either.
+      void write(const char* str, size_t length)
+      {
+         if (size <= capacity && length <= capacity - size)
+            std::memcpy(data + size, str, length);
+
+         size += length;
+      }
+
+      char* data;
+      size_t capacity;
+      size_t size;
+   };
+
+   inline void json_put(std::ostream& os, char c)
+   {
+      os.put(c);
+   }
+
+   inline void json_put(json_buffer& buffer, char c)
+   {
+      buffer.put(c);
+   }
+
+   inline void json_put(json_size_counter& counter, char)
+   {
+      ++counter.size;
+   }
+
+   inline void json_put(json_fixed_buffer& buffer, char c)
+   {
+      buffer.write(&c, 1);
+   }
+
+   inline void json_write(std::ostream& os, const char* str, size_t length)
+   {
+      os.write(str, length);
+   }
+
+   inline void json_write(json_buffer& buffer, const char* str, size_t length)
+   {
+      buffer.write(str, length);
+   }
+
+   inline void json_write(json_size_counter& counter, const char*, size_t length)
+   {
+      counter.size += length;
+   }
+
+   inline void json_write(json_fixed_buffer& buffer, const char* str, size_t length)
+   {
+      buffer.write(str, length);
+   }
+
+   /// Helper for quoting strings.
+   ADHD_JSON_API void json_write_quoted_string(std::ostream& os, const std::string& str);
+
+   ADHD_JSON_API void json_write_quoted_string(json_buffer& buffer, const std::string& str);
+
+   ADHD_JSON_API void json_write_quoted_string(json_size_counter& counter, const std::string& str);
+
+   ADHD_JSON_API void json_write_quoted_string(json_fixed_buffer& buffer, const std::string& str);
+
+   ADHD_JSON_API void json_write_quoted_string(std::ostream& os, const char* str, size_t length);
+
+   ADHD_JSON_API void json_write_quoted_string(json_buffer& buffer, const char* str, size_t length);
+
+   ADHD_JSON_API void json_write_quoted_string(json_size_counter& counter, const char* str, size_t length);
+
+   ADHD_JSON_API void json_write_quoted_string(json_fixed_buffer& buffer, const char* str, size_t length);
+
+   /// Writes the characters of [first, last) escaped as by
+   /// json_write_quoted_string, without the quotes, to [out, out_end),
+   /// advancing out. Stops when the output is full or before an escape
+   /// sequence that does not fit, returning the first character not
+   /// written.
+   ADHD_JSON_API const char* json_write_escaped(char*& out, char* out_end, const char* first, const char* last);
+
+   /// Returns the first character in [first, last) that
+   /// json_write_quoted_string escapes, or last.
+   ADHD_JSON_API const char* json_find_escape(const char* first, const char* last);
+
+   /// Helper for writing numbers.
+   ADHD_JSON_API void json_write_number(std::ostream& os, double d);
+
+   ADHD_JSON_API void json_write_number(json_buffer& buffer, double d);
+
+   ADHD_JSON_API void json_write_number(json_size_counter& counter, double d);
+
+   ADHD_JSON_API void json_write_number(json_fixed_buffer& buffer, double d);
+
+   /// Visitor for writing a JSON value in a compact way to a TOutput,
+   /// a std::ostream, json_buffer, json_size_counter or json_fixed_buffer.
+   template <typename TOutput>
+   struct basic_json_writer
+   {
+      enum skip_state
+      {
+         skip_none,
+         skip_comma,
+      };
+
+      TOutput& out;
+      skip_state skip;
+
+      explicit basic_json_writer(TOutput& out)
+         : out(out)
+         , skip(skip_comma)
+      {
+      }
+
+      void null_value()
+      {
+         json_write(out, "null", 4);
+      }
+
+      void string_value(const std::string& val)
+      {
+         json_write_quoted_string(out, val);
+      }
+
+      void string_value(const char* str, size_t length)
+      {
+         json_write_quoted_string(out, str, length);
+      }
+
+      void number_value(double val)
+      {
+         json_write_number(out, val);
+      }
+
+      void bool_value(bool val)
+      {
+         if (val)
+            json_write(out, "true", 4);
+         else
+            json_write(out, "false", 5);
+      }
+
+      /// Writes an array or object given as JSON text, see json_raw.
+      void raw_value(const char* text, size_t length)
+      {
+         json_write(out, text, length);
+         skip = skip_none;
+      }
+
+      void begin_array()
+      {
+         json_put(out, '[');
+         skip = skip_comma;
+      }
+
+      void end_array()
+      {
+         json_put(out, ']');
+         skip = skip_none;
+      }
+
+      void begin_object()
+      {
+         json_put(out, '{');
+         skip = skip_comma;
+      }
+
+      void end_object()
+      {
+         json_put(out, '}');
+         skip = skip_none;
+      }
+
+      void begin_key()
+      {
+         if (skip == skip_comma)
+            skip = skip_none;
+         else
+            json_put(out, ',');
+      }
+
+      void end_key()
+      {
+         json_put(out, ':');
+         skip = skip_comma;
+      }
+
+      void begin_value()
+      {
+         if (skip == skip_comma)
+            skip = skip_none;
+         else
+            json_put(out, ',');
+      }
+
+      void end_value()
+      {
+      }
+   };
+
+   typedef basic_json_writer<std::ostream> json_writer;
+   typedef basic_json_writer<json_buffer> json_buffer_writer;
+   typedef basic_json_writer<json_size_counter> json_size_writer;
+   typedef basic_json_writer<json_fixed_buffer> json_fixed_writer;
+
+   /// Visitor for writing a JSON value in a pretty way, using newlines and
+   /// indents, to a TOutput, see basic_json_writer.
+   template <typename TOutput>
+   struct basic_json_pretty_printer
+   {
+      enum skip_state
+      {
+         skip_none,
+         skip_comma_xor_newline,
+         skip_comma_and_newline,
+      };
+
+      TOutput& out;
+      skip_state skip;
+      int indent_level;
+      const std::string indent;
+
+      basic_json_pretty_printer(TOutput& out, size_t indent_size)
+         : out(out)
+         , skip(skip_comma_and_newline)
+         , indent_level(0)
+         , indent(indent_size, ' ')
+      {
+      }
+
+      void newline()
+      {
+         json_put(out, '\n');
+
+         for (int i = 0; i < indent_level; ++i)
+         {
+            json_write(out, indent.data(), indent.size());
+         }
+      }
+
+      void null_value()
+      {
+         json_write(out, "null", 4);
+      }
+
+      void string_value(const std::string& val)
+      {
+         json_write_quoted_string(out, val);
+      }
+
+      void string_value(const char* str, size_t length)
+      {
+         json_write_quoted_string(out, str, length);
+      }
+
+      void number_value(double val)
+      {
+         json_write_number(out, val);
+      }
+
+      void bool_value(bool val)
+      {
+         if (val)
+            json_write(out, "true", 4);
+         else
+            json_write(out, "false", 5);
+      }
+
+      void begin_array()
+      {
+         json_put(out, '[');
+         skip = skip_comma_xor_newline;
+         ++indent_level;
+      }
+
+      void end_array()
+      {
+         --indent_level;
+         if (skip == skip_none)
+         {
+            newline();
+         }
+
+         json_put(out, ']');
+         skip = skip_none;
+      }
+
+      void begin_object()
+      {
+         json_put(out, '{');
+         skip = skip_comma_and_newline;
+         ++indent_level;
+      }
+
+      void end_object()
+      {
+         --indent_level;
+         if (skip == skip_none)
+         {
+            newline();
+         }
+
+         json_put(out, '}');
+         skip = skip_none;
+      }
+
+      void begin_key()
+      {
+         if (skip == skip_none)
+         {
+            json_put(out, ',');
+         }
+
+         newline();
+         skip = skip_none;
+      }
+
+      void end_key()
+      {
+         json_write(out, ": ", 2);
+         skip = skip_comma_and_newline;
+      }
+
+      void begin_value()
+      {
+         if (skip == skip_none)
+         {
+            json_put(out, ',');
+            newline();
+         }
+         else if (skip == skip_comma_xor_newline)
+         {
+            newline();
+         }
+
+         skip = skip_none;
+      }
+
+      void end_value()
+      {
+      }
+   };
+
+   typedef basic_json_pretty_printer<std::ostream> json_pretty_printer;
+   typedef basic_json_pretty_printer<json_buffer> json_buffer_pretty_printer;
+   typedef basic_json_pretty_printer<json_size_counter> json_size_pretty_printer;
+   typedef basic_json_pretty_printer<json_fixed_buffer> json_fixed_pretty_printer;
+}
+
+#endif
@@ -0,0 +1,214 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Checks of json_compact_value, using json_nan_boxed_layout: every double
+// is kept bit for bit but for NaN, boxed values are told apart from
+// numbers, strings are kept inline up to the short string capacity, and
+// random documents behave as with json_value. Build with json_value.cpp;
+// returns non-zero on failure.
+
+#include "../json_value.h"
+#include "../json_parser.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+namespace
+{
+   int failures = 0;
+
+   void check(bool condition, const char* what, int step)
+   {
+      if (!condition)
+      {
+         if (++failures <= 10)
+            std::printf("FAILED: %s at step %d\n", what, step);
+      }
+   }
+
+   /// Deterministic so that failures reproduce.
+   boost::uint64_t next_random()
+   {
+      static boost::uint64_t state = 12345;
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      return state;
+   }
+
+   bool same_bits(double a, double b)
+   {
+      return std::memcmp(&a, &b, sizeof(a)) == 0;
+   }
+
+   double from_bits(boost::uint64_t bits)
+   {
+      double d;
+      std::memcpy(&d, &bits, sizeof(d));
+      return d;
+   }
+
+   void test_size()
+   {
+      check(sizeof(adhd::json_compact_value) == 8, "8 byte values", -1);
+   }
+
+   void test_numbers()
+   {
+      const double numbers[] =
+      {
+         0.0,
+         -0.0,
+         1.0,
+         -1.5,
+         std::numeric_limits<double>::infinity(),
+         -std::numeric_limits<double>::infinity(),
+         std::numeric_limits<double>::max(),
+         std::numeric_limits<double>::min(),
+         std::numeric_limits<double>::denorm_min(),
+         -std::numeric_limits<double>::denorm_min(),
+      };
+
+      for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i)
+      {
+         const adhd::json_compact_value value(numbers[i]);
+         check(value.is_number() && same_bits(value.get_number(), numbers[i]), "number kept", static_cast<int>(i));
+      }
+
+      for (int step = 0; step < 100000; ++step)
+      {
+         const double number = from_bits(next_random());
+         const adhd::json_compact_value value(number);
+         check(value.is_number(), "number type", step);
+         if (number == number)
+            check(same_bits(value.get_number(), number), "random number kept", step);
+         else
+            check(value.get_number() != value.get_number(), "NaN kept as NaN", step);
+      }
+
+      // NaNs with the bits of boxed values are numbers all the same.
+      const boost::uint64_t nans[] = { 0xfff8000000000000ull, 0xfff9000000000001ull, 0xffff123456789abcull, 0x7ff0000000000001ull };
+      for (size_t i = 0; i < sizeof(nans) / sizeof(nans[0]); ++i)
+      {
+         const adhd::json_compact_value value(from_bits(nans[i]));
+         check(value.is_number() && value.get_number() != value.get_number(), "NaN folded", static_cast<int>(i));
+      }
+   }
+
+   void test_scalars()
+   {
+      check(adhd::json_compact_value().is_null(), "null", -1);
+      check(adhd::json_compact_value(adhd::json_bool(true)).get_bool(), "true", -1);
+      check(!adhd::json_compact_value(adhd::json_bool(false)).get_bool(), "false", -1);
+      check(adhd::json_compact_value(adhd::json_bool(false)).is_bool(), "bool type", -1);
+
+      // Inline and heap strings of every length around the capacity,
+      // including embedded null characters.
+      for (size_t length = 0; length <= 12; ++length)
+      {
+         std::string str;
+         for (size_t i = 0; i < length; ++i)
+            str += static_cast<char>(i % 3 == 1 ? 0 : 'a' + i);
+
+         const adhd::json_compact_value value(str);
+         const adhd::json_compact_value copy = value;
+         check(value.is_string() && value.get_string() == str, "string kept", static_cast<int>(length));
+         check(copy == value && copy.hash() == value.hash(), "string copied", static_cast<int>(length));
+      }
+   }
+
+   /// Random documents, with every kind of value, as text.
+   std::string make_text(int depth)
+   {
+      switch (depth > 0 ? next_random() % 8 : next_random() % 5)
+      {
+      case 0:
+         return "null";
+      case 1:
+         return next_random() % 2 == 0 ? "true" : "false";
+      case 2:
+      {
+         adhd::json_value number(static_cast<double>(static_cast<boost::int64_t>(next_random() % 2000001) - 1000000) / 64);
+         return number.to_string();
+      }
+      case 3:
+         return "\"" + std::string(next_random() % 10, 'x') + "\"";
+      case 4:
+         return "[1,2.5,-3]";
+      case 5:
+      {
+         std::string text = "[";
+         for (int i = next_random() % 5; i != 0; --i)
+            text += (text.size() > 1 ? "," : "") + make_text(depth - 1);
+
+         return text + "]";
+      }
+      default:
+      {
+         std::string text = "{";
+         for (int i = next_random() % 5; i != 0; --i)
+            text += (text.size() > 1 ? ",\"" : "\"") + std::string(next_random() % 8, 'k') + "\":" + make_text(depth - 1);
+
+         return text + "}";
+      }
+      }
+   }
+
+   void test_documents()
+   {
+      for (int step = 0; step < 2000; ++step)
+      {
+         const std::string text = "[" + make_text(4) + "]";
+         adhd::json_value value;
+         adhd::json_parser().parse(text.c_str(), value);
+         adhd::json_compact_value compact;
+         adhd::json_parser().parse(text.c_str(), compact);
+
+         check(compact.to_string() == value.to_string(), "same output as json_value", step);
+         check(compact.serialized_size() == value.serialized_size(), "same size as json_value", step);
+
+         adhd::json_compact_value copy = compact;
+         check(copy == compact && copy.hash() == compact.hash(), "copy equal", step);
+         copy.append_child() = adhd::json_compact_value(adhd::json_bool(true));
+         check(copy != compact && compact.to_string() == value.to_string(), "copy modified alone", step);
+      }
+   }
+
+   void test_arrays()
+   {
+      adhd::json_compact_value array = adhd::json_compact_value(adhd::json_array());
+      for (int i = 0; i < 1000; ++i)
+         array.append_child() = adhd::json_compact_value(static_cast<double>(i) / 4);
+
+      array.append_child() = adhd::json_compact_value(std::string("tail"));
+      check(array.get_length() == 1001 && array.get_child(999).get_number() == 999.0 / 4, "array of numbers", -1);
+      check(array.get_child(1000).get_string() == "tail", "array ends with string", -1);
+
+      adhd::json_compact_value object = adhd::json_compact_value(adhd::json_object());
+      object.put_child("array") = array;
+      object.put_child("raw") = adhd::json_compact_value(adhd::json_raw("{\"a\":[1]}"));
+      check(object.get_child("raw").is_object() && object.get_child("raw").get_child("a").get_child(0).get_number() == 1, "raw object", -1);
+      check(object.get_child("array").get_child(3).get_number() == 0.75, "array member", -1);
+   }
+}
+
+int main()
+{
+   test_size();
+   test_numbers();
+   test_scalars();
+   test_documents();
+   test_arrays();
+
+   if (failures != 0)
+   {
+      std::printf("%d failures\n", failures);
+      return EXIT_FAILURE;
+   }
+
+   std::printf("passed\n");
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,193 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Randomized check of the object storage policies against std::map, and
+// against the insertion order for hashed and shaped objects, with names
+// inserted, replaced and erased in turn, and of shaped objects sharing
+// member names between parsed records. Build with json_value.cpp; returns
+// non-zero on failure.
+
+#include "../json_value.h"
+#include "../json_parser.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+   int failures = 0;
+
+   void check(bool condition, const char* what, int step)
+   {
+      if (!condition)
+      {
+         if (++failures <= 10)
+            std::printf("FAILED: %s at step %d\n", what, step);
+      }
+   }
+
+   /// Deterministic so that failures reproduce.
+   unsigned next_random()
+   {
+      static unsigned state = 12345;
+      state = state * 1103515245u + 12345u;
+      return (state >> 8) & 0xffffff;
+   }
+
+   std::string make_name(unsigned i)
+   {
+      std::ostringstream os;
+      os << "key" << i;
+      return os.str();
+   }
+
+   /// Checks the members of value against those of model, in insertion
+   /// order if order is not empty and by name otherwise.
+   template <typename TValue>
+   void check_members(const TValue& value, const std::map<std::string, double>& model, const std::vector<std::string>& order, int step)
+   {
+      std::vector<std::string> names;
+      typedef typename TValue::const_member_iterator iterator;
+      const boost::iterator_range<iterator> members = value.members();
+      for (iterator i = members.begin(), e = members.end(); i != e; ++i)
+         names.push_back(std::string((*i).first.data(), (*i).first.size()));
+
+      check(names.size() == model.size(), "member count", step);
+
+      if (order.empty())
+      {
+         std::vector<std::string> sorted;
+         for (std::map<std::string, double>::const_iterator i = model.begin(), e = model.end(); i != e; ++i)
+            sorted.push_back(i->first);
+
+         check(names == sorted, "members ordered by name", step);
+      }
+      else
+      {
+         check(names == order, "members in insertion order", step);
+      }
+
+      for (std::map<std::string, double>::const_iterator i = model.begin(), e = model.end(); i != e; ++i)
+      {
+         const TValue* child = value.find_child(i->first);
+         check(child && child->get_number() == i->second, "member found", step);
+      }
+   }
+
+   /// Inserts, replaces and erases members at random, with up to names
+   /// members, so that objects grow past the threshold of the adaptive
+   /// storage and shrink back below it.
+   template <typename TObjects>
+   void test_objects(bool insertion_order, unsigned names)
+   {
+      typedef adhd::basic_json_value<adhd::json_tagged_layout, TObjects> value_type;
+
+      value_type value = value_type(adhd::json_object());
+      std::map<std::string, double> model;
+      std::vector<std::string> order;
+
+      for (int step = 0; step < 20000; ++step)
+      {
+         const std::string name = make_name(next_random() % names);
+         const double number = next_random() % 1000;
+         if (next_random() % 3 == 0)
+         {
+            const bool erased = value.erase_child(name);
+            check(erased == (model.erase(name) != 0), "erase", step);
+            order.erase(std::remove(order.begin(), order.end(), name), order.end());
+         }
+         else
+         {
+            if (model.find(name) == model.end())
+               order.push_back(name);
+
+            value.put_child(name) = value_type(number);
+            model[name] = number;
+         }
+
+         check(!value.find_child(make_name(names)), "missing member not found", step);
+
+         if (step % 97 == 0)
+            check_members(value, model, insertion_order ? order : std::vector<std::string>(), step);
+      }
+
+      check_members(value, model, insertion_order ? order : std::vector<std::string>(), -1);
+   }
+
+   typedef adhd::basic_json_value<adhd::json_tagged_layout, adhd::json_shaped_objects> shaped_value;
+
+   const char* member_name(const shaped_value& object, size_t i)
+   {
+      shaped_value::const_member_iterator member = object.members().begin();
+      std::advance(member, i);
+      return (*member).first.data();
+   }
+
+   void test_shaped_records()
+   {
+      // Records alike but for the last two, with names in another order
+      // and a repeated name.
+      std::string text = "[";
+      for (int i = 0; i < 1000; ++i)
+      {
+         std::ostringstream os;
+         os << (i == 0 ? "" : ",") << "{\"id\":" << i << ",\"name\":\"n\",\"tags\":[{\"x\":" << i << "}]}";
+         text += os.str();
+      }
+
+      text += ",{\"name\":\"m\",\"id\":1000},{\"id\":1001,\"id\":1002,\"name\":\"o\"}]";
+
+      shaped_value value;
+      adhd::json_parser().parse(text.c_str(), value);
+      check(value.to_string() == text.substr(0, text.rfind(",{")) + ",{\"id\":1002,\"name\":\"o\"}]", "records written back", -1);
+
+      const shaped_value& first = value.get_child(0);
+      const shaped_value& last_alike = value.get_child(999);
+      check(member_name(first, 0) == member_name(last_alike, 0) && member_name(first, 2) == member_name(last_alike, 2), "names shared by records", -1);
+      check(member_name(first.get_child("tags").get_child(0), 0) == member_name(last_alike.get_child("tags").get_child(0), 0), "names shared by nested records", -1);
+      check(member_name(value.get_child(1000), 0) != member_name(first, 0), "names in another order not shared", -1);
+
+      static const adhd::json_key id("id");
+      for (int i = 0; i < 1001; ++i)
+         check(value.get_child(i).get_child(id).get_number() == i, "member found by key", i);
+
+      check(value.get_child(1001).get_child(id).get_number() == 1002, "repeated name keeps the last value", -1);
+      check(value.get_child(1001).get_child("name").get_string() == "o", "member after repeated name", -1);
+
+      // Changing one record leaves the others, and their names, alone.
+      shaped_value copy = value;
+      copy.put_child(5).put_child("extra") = shaped_value(1.0);
+      copy.put_child(6).erase_child("id");
+      check(value.get_child(5).find_child("extra") == 0 && value.get_child(6).get_child(id).get_number() == 6, "records of the original untouched", -1);
+      check(copy.get_child(5).get_child("extra").get_number() == 1 && copy.get_child(6).find_child(id) == 0, "records of the copy changed", -1);
+      check(copy.get_child(7).get_child(id).get_number() == 7 && member_name(copy.get_child(7), 0) == member_name(first, 0), "other records of the copy shared", -1);
+   }
+}
+
+int main()
+{
+   test_objects<adhd::json_hashed_objects>(true, 300);
+   test_objects<adhd::json_hashed_objects>(true, 20);
+   test_objects<adhd::json_flat_objects>(false, 300);
+   test_objects<adhd::json_map_objects>(false, 300);
+   test_objects<adhd::json_shaped_objects>(true, 300);
+   test_objects<adhd::json_shaped_objects>(true, 20);
+   test_shaped_records();
+
+   if (failures != 0)
+   {
+      std::printf("%d failures\n", failures);
+      return EXIT_FAILURE;
+   }
+
+   std::printf("passed\n");
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Checks that numbers read by json_parser are correctly rounded, so that
+// every double written by to_string reads back as the same double. Build
+// with json_value.cpp; returns non-zero on failure.
+
+#include "../json_value.h"
+#include "../json_parser.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace
+{
+   int failures = 0;
+
+   void check(bool condition, const char* what, const std::string& text)
+   {
+      if (!condition)
+      {
+         if (++failures <= 10)
+            std::printf("FAILED: %s for %s\n", what, text.c_str());
+      }
+   }
+
+   /// Deterministic so that failures reproduce.
+   boost::uint64_t next_random()
+   {
+      static boost::uint64_t state = 12345;
+      state = state * 6364136223846793005ull + 1442695040888963407ull;
+      return state;
+   }
+
+   bool same_bits(double a, double b)
+   {
+      return std::memcmp(&a, &b, sizeof(a)) == 0;
+   }
+
+   double parse_number(const std::string& text)
+   {
+      adhd::json_value value;
+      adhd::json_parser().parse(("[" + text + "]").c_str(), value);
+      return value.get_child(0).get_number();
+   }
+
+   void test_round_trip()
+   {
+      for (int step = 0; step < 200000; ++step)
+      {
+         // Every bit pattern, and integers and short fractions as common in documents.
+         boost::uint64_t bits = next_random();
+         double number;
+         std::memcpy(&number, &bits, sizeof(number));
+         if (step % 2 != 0)
+            number = static_cast<double>(static_cast<boost::int64_t>(bits % 2000000) - 1000000) / 1000;
+
+         // NaN and infinities are not written as numbers.
+         if (number != number || number - number != 0)
+            continue;
+
+         adhd::json_value array = adhd::json_value(adhd::json_array());
+         array.append_child() = adhd::json_value(number);
+         const std::string text = array.to_string();
+
+         adhd::json_value parsed;
+         adhd::json_parser().parse(text.c_str(), parsed);
+         check(same_bits(parsed.get_child(0).get_number(), number) || number == 0, "round trip", text);
+      }
+   }
+
+   void test_rounding()
+   {
+      // Nearest double, ties to even, for text std::strtod is known to get right.
+      const char* const texts[] =
+      {
+         "0.1",
+         "2.2250738585072011e-308",
+         "2.2250738585072012e-308",
+         "4.9406564584124654e-324",
+         "2.4703282292062328e-324",
+         "1.7976931348623157e308",
+         "9007199254740993",
+         "9007199254740993.0000000000000000000000000000001",
+         "123456789012345678901234567890",
+         "0.000000000000000000000000000000000001",
+         "1.00000000000000011102230246251565404236316680908203125",
+         "1.00000000000000011102230246251565404236316680908203124",
+         "1.00000000000000011102230246251565404236316680908203126",
+         "1e-400",
+         "-0",
+      };
+
+      for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i)
+      {
+         check(same_bits(parse_number(texts[i]), std::strtod(texts[i], 0)), "rounding", texts[i]);
+      }
+
+      // More digits than are kept, with a digit other than zero past them.
+      const std::string halfway = "9007199254740993" + std::string(1000, '0');
+      check(same_bits(parse_number(halfway + "e-1000"), 9007199254740992.0), "halfway", "9007199254740993 followed by zeros");
+      check(same_bits(parse_number(halfway + "1e-1001"), 9007199254740994.0), "above halfway", "9007199254740993 followed by zeros and 1");
+
+      check(parse_number("1e999999999999") > 1.7976931348623157e308, "overflow", "1e999999999999");
+      check(parse_number("1e-999999999999") == 0, "underflow", "1e-999999999999");
+   }
+}
+
+int main()
+{
+   test_round_trip();
+   test_rounding();
+
+   if (failures != 0)
+   {
+      std::printf("%d failures\n", failures);
+      return EXIT_FAILURE;
+   }
+
+   std::printf("passed\n");
+   return EXIT_SUCCESS;
+}
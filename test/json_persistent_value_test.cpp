@@ -0,0 +1,222 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Randomized check of json_persistent_value against std::vector and
+// std::map, keeping every version to confirm that updates leave earlier
+// versions untouched. Build with json_value.cpp and
+// json_persistent_value.cpp; returns non-zero on failure.
+
+#include "../json_persistent_value.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+   int failures = 0;
+
+   void check(bool condition, const char* what, int step)
+   {
+      if (!condition)
+      {
+         if (++failures <= 10)
+            std::printf("FAILED: %s at step %d\n", what, step);
+      }
+   }
+
+   /// Deterministic so that failures reproduce.
+   unsigned next_random()
+   {
+      static unsigned state = 12345;
+      state = state * 1103515245u + 12345u;
+      return (state >> 8) & 0xffffff;
+   }
+
+   std::string make_name(unsigned i)
+   {
+      std::ostringstream os;
+      os << "key" << i;
+      return os.str();
+   }
+
+   /// Collects the members of a flat object of numbers.
+   struct member_collector
+   {
+      std::map<std::string, double> members;
+      std::string key;
+      bool in_key;
+      int depth;
+
+      member_collector()
+         : in_key(false)
+         , depth(0)
+      {
+      }
+
+      void null_value() {}
+      void string_value(const std::string& val) { if (in_key) key = val; }
+      void number_value(double val) { members[key] = val; }
+      void bool_value(bool) {}
+      void begin_array() { ++depth; }
+      void end_array() { --depth; }
+      void begin_object() { ++depth; }
+      void end_object() { --depth; }
+      void begin_key() { in_key = true; }
+      void end_key() { in_key = false; }
+      void begin_value() {}
+      void end_value() {}
+   };
+
+   bool matches(const adhd::json_persistent_value& value, const std::vector<double>& model)
+   {
+      if (!(model.empty() ? value.is_null() || value.is_array() : value.is_array()) || value.get_length() != model.size())
+         return false;
+
+      for (size_t i = 0; i < model.size(); ++i)
+      {
+         if (value.get_child(i).get_number() != model[i])
+            return false;
+      }
+
+      return true;
+   }
+
+   bool matches(const adhd::json_persistent_value& value, const std::map<std::string, double>& model)
+   {
+      for (std::map<std::string, double>::const_iterator i = model.begin(), e = model.end(); i != e; ++i)
+      {
+         const adhd::json_persistent_value* child = value.find_child(i->first);
+         if (!child || child->get_number() != i->second)
+            return false;
+      }
+
+      member_collector collector;
+      value.accept(collector);
+      return collector.members == model;
+   }
+
+   void test_array()
+   {
+      std::vector<adhd::json_persistent_value> versions(1);
+      std::vector<std::vector<double> > models(1);
+
+      for (int step = 0; step < 20000; ++step)
+      {
+         const size_t from = next_random() % versions.size();
+         adhd::json_persistent_value value = versions[from];
+         std::vector<double> model = models[from];
+
+         const double number = next_random();
+         switch (next_random() % 4)
+         {
+         case 0:
+         case 1:
+            value = value.with_appended(adhd::json_persistent_value(number));
+            model.push_back(number);
+            break;
+
+         case 2:
+         {
+            const size_t i = next_random() % (model.size() + 1);
+            value = value.with_element(i, adhd::json_persistent_value(number));
+            if (i == model.size())
+               model.push_back(number);
+            else
+               model[i] = number;
+            break;
+         }
+
+         case 3:
+         {
+            // Truncate, or pad with nulls and then give them numbers.
+            const size_t length = next_random() % (model.size() + 40);
+            value = value.with_length(length);
+            check(value.get_length() == length, "with_length", step);
+            for (size_t i = model.size(); i < length; ++i)
+            {
+               check(value.get_child(i).is_null(), "padding is null", step);
+               value = value.with_element(i, adhd::json_persistent_value(number));
+            }
+
+            model.resize(length, number);
+            break;
+         }
+         }
+
+         check(matches(value, model), "array matches model", step);
+         versions.push_back(value);
+         models.push_back(model);
+      }
+
+      for (size_t i = 0; i < versions.size(); ++i)
+      {
+         check(matches(versions[i], models[i]), "old array version untouched", static_cast<int>(i));
+      }
+   }
+
+   void test_object()
+   {
+      std::vector<adhd::json_persistent_value> versions(1);
+      std::vector<std::map<std::string, double> > models(1);
+
+      for (int step = 0; step < 20000; ++step)
+      {
+         const size_t from = next_random() % versions.size();
+         adhd::json_persistent_value value = versions[from];
+         std::map<std::string, double> model = models[from];
+
+         // A key space large enough for several trie levels.
+         const std::string name = make_name(next_random() % 4000);
+         if (next_random() % 3 != 0)
+         {
+            const double number = next_random();
+            value = value.with_child(name, adhd::json_persistent_value(number));
+            model[name] = number;
+         }
+         else
+         {
+            value = value.without_child(name);
+            model.erase(name);
+         }
+
+         check(matches(value, model), "object matches model", step);
+         versions.push_back(value);
+         models.push_back(model);
+      }
+
+      for (size_t i = 0; i < versions.size(); ++i)
+      {
+         check(matches(versions[i], models[i]), "old object version untouched", static_cast<int>(i));
+
+         // Equal contents compare equal whatever order they were built in.
+         adhd::json_persistent_value rebuilt = adhd::json_persistent_value(adhd::json_object());
+         for (std::map<std::string, double>::const_reverse_iterator j = models[i].rbegin(), e = models[i].rend(); j != e; ++j)
+         {
+            rebuilt = rebuilt.with_child(j->first, adhd::json_persistent_value(j->second));
+         }
+
+         check(models[i].empty() || rebuilt == versions[i], "rebuilt object equal", static_cast<int>(i));
+      }
+   }
+}
+
+int main()
+{
+   test_array();
+   test_object();
+
+   if (failures != 0)
+   {
+      std::printf("%d failures\n", failures);
+      return EXIT_FAILURE;
+   }
+
+   std::printf("passed\n");
+   return EXIT_SUCCESS;
+}
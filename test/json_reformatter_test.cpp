@@ -0,0 +1,245 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Randomized check of json_reformatter against to_string and
+// to_pretty_string, reformatting random documents with random whitespace
+// given in pieces of random sizes, and of lexemes copied verbatim and
+// invalid documents refused. Build with json_value.cpp and
+// json_reformatter.cpp; returns non-zero on failure.
+
+#include "../json_reformatter.h"
+#include "../json_value.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+namespace
+{
+   int failures = 0;
+
+   void check(bool condition, const char* what, const std::string& text)
+   {
+      if (!condition)
+      {
+         if (++failures <= 10)
+            std::printf("FAILED: %s for %s\n", what, text.substr(0, 200).c_str());
+      }
+   }
+
+   /// Deterministic so that failures reproduce.
+   unsigned next_random()
+   {
+      static unsigned state = 12345;
+      state = state * 1103515245u + 12345u;
+      return (state >> 8) & 0xffffff;
+   }
+
+   std::string make_string()
+   {
+      static const char* const pieces[] = { "a", "xyz", "\"", "\\", "\n", "\x01", "/", "\xc3\xa5" };
+      std::string str;
+      for (unsigned i = next_random() % 8; i != 0; --i)
+         str += pieces[next_random() % (sizeof(pieces) / sizeof(pieces[0]))];
+
+      return str;
+   }
+
+   adhd::json_value make_value(int depth)
+   {
+      switch (depth > 0 ? next_random() % 6 : next_random() % 4)
+      {
+      case 0:
+         return adhd::json_value();
+      case 1:
+         return adhd::json_value(adhd::json_bool(next_random() % 2 == 0));
+      case 2:
+         return adhd::json_value(next_random() % 2 == 0 ? static_cast<double>(next_random()) / 7 : -1e300);
+      case 3:
+         return adhd::json_value(make_string());
+      case 4:
+      {
+         adhd::json_value array = adhd::json_value(adhd::json_array());
+         for (unsigned i = next_random() % 5; i != 0; --i)
+            array.append_child() = make_value(depth - 1);
+
+         return array;
+      }
+      default:
+      {
+         adhd::json_value object = adhd::json_value(adhd::json_object());
+         for (unsigned i = next_random() % 5; i != 0; --i)
+            object.put_child(make_string()) = make_value(depth - 1);
+
+         return object;
+      }
+      }
+   }
+
+   /// Documents are arrays or objects.
+   adhd::json_value make_document()
+   {
+      adhd::json_value value = make_value(4);
+      while (!value.is_array() && !value.is_object())
+         value = make_value(4);
+
+      return value;
+   }
+
+   /// Adds random whitespace around the structural characters of compact
+   /// text, outside of strings.
+   std::string add_whitespace(const std::string& text)
+   {
+      static const char* const spaces[] = { "", "", " ", "\t", "\r\n", "  \n    " };
+      std::string spaced = spaces[next_random() % 6];
+      bool in_string = false;
+      for (size_t i = 0; i < text.size(); ++i)
+      {
+         const char c = text[i];
+         spaced += c;
+         if (in_string)
+         {
+            if (c == '\\')
+               spaced += text[++i];
+            else if (c == '"')
+               in_string = false;
+         }
+         else if (c == '"')
+         {
+            in_string = true;
+         }
+
+         if (!in_string && std::strchr(",:[]{}\"", c))
+            spaced += spaces[next_random() % 6];
+      }
+
+      return spaced;
+   }
+
+   /// Writes text to reformatter in pieces of random sizes.
+   void write_pieces(adhd::json_reformatter& reformatter, const std::string& text)
+   {
+      for (size_t i = 0; i < text.size();)
+      {
+         const size_t size = std::min<size_t>(next_random() % 8 == 0 ? next_random() % 1000 : next_random() % 4, text.size() - i);
+         reformatter.write(text.data() + i, size);
+         i += size;
+      }
+
+      reformatter.finish();
+   }
+
+   /// Reformats text, minified if indent_size is 0.
+   std::string reformat(const std::string& text, size_t indent_size)
+   {
+      adhd::json_buffer buffer;
+      if (indent_size != 0)
+      {
+         adhd::json_reformatter reformatter(buffer, indent_size);
+         write_pieces(reformatter, text);
+      }
+      else
+      {
+         adhd::json_reformatter reformatter(buffer);
+         write_pieces(reformatter, text);
+      }
+
+      std::string output;
+      buffer.release(output);
+      return output;
+   }
+
+   bool refused(const std::string& text)
+   {
+      try
+      {
+         reformat(text, 0);
+         return false;
+      }
+      catch (const adhd::json_parse_exception&)
+      {
+         return true;
+      }
+   }
+
+   void test_random()
+   {
+      for (int step = 0; step < 2000; ++step)
+      {
+         const adhd::json_value value = make_document();
+         const std::string text = add_whitespace(value.to_string());
+         check(reformat(text, 0) == value.to_string(), "minified as to_string", text);
+         check(reformat(text, 4) == value.to_pretty_string(4), "pretty printed as to_pretty_string", text);
+         check(reformat(value.to_pretty_string(2), 3) == value.to_pretty_string(3), "pretty printed again", text);
+      }
+   }
+
+   void test_verbatim()
+   {
+      const std::string text = "[ 1.50 , -0.0e+10, 1E400, \"\\u00e5\\/\" ]";
+      check(reformat(text, 0) == "[1.50,-0.0e+10,1E400,\"\\u00e5\\/\"]", "lexemes copied verbatim", text);
+   }
+
+   void test_refused()
+   {
+      const char* const texts[] =
+      {
+         "",
+         "[1,]",
+         "[01]",
+         "[1.]",
+         "[-]",
+         "{\"a\" 1}",
+         "{\"a\":1,}",
+         "{1:2}",
+         "[\"\\x\"]",
+         "[\"\\u12g4\"]",
+         "[\"\x01\"]",
+         "[tru]",
+         "[nul",
+         "[1] 2",
+         "]",
+      };
+
+      for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); ++i)
+         check(refused(texts[i]), "invalid document refused", texts[i]);
+   }
+
+   void test_streams()
+   {
+      std::istringstream is(" { \"a\" : [ 1 , true ] } ");
+      std::ostringstream minified;
+      adhd::json_minify(is, minified);
+      check(minified.str() == "{\"a\":[1,true]}", "json_minify", minified.str());
+
+      std::istringstream again(minified.str());
+      std::ostringstream pretty;
+      adhd::json_pretty_print(again, pretty, 4);
+      adhd::json_value value;
+      value.put_child("a").append_child() = adhd::json_value(1.0);
+      value.put_child("a").append_child() = adhd::json_value(adhd::json_bool(true));
+      check(pretty.str() == value.to_pretty_string(4), "json_pretty_print", pretty.str());
+   }
+}
+
+int main()
+{
+   test_random();
+   test_verbatim();
+   test_refused();
+   test_streams();
+
+   if (failures != 0)
+   {
+      std::printf("%d failures\n", failures);
+      return EXIT_FAILURE;
+   }
+
+   std::printf("passed\n");
+   return EXIT_SUCCESS;
+}
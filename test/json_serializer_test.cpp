@@ -0,0 +1,180 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Randomized check of json_serializer against to_string, writing random
+// documents in pieces of many sizes, down to one character, so that it
+// stops and resumes inside every kind of token. Build with json_value.cpp;
+// returns non-zero on failure.
+
+#include "../json_serializer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+   int failures = 0;
+
+   void check(bool condition, const char* what, int step)
+   {
+      if (!condition)
+      {
+         if (++failures <= 10)
+            std::printf("FAILED: %s at step %d\n", what, step);
+      }
+   }
+
+   /// Deterministic so that failures reproduce.
+   unsigned next_random()
+   {
+      static unsigned state = 12345;
+      state = state * 1103515245u + 12345u;
+      return (state >> 8) & 0xffffff;
+   }
+
+   /// Strings of every length up to a few hundred characters, with
+   /// characters to escape, including control characters written as
+   /// \u escapes, and UTF-8 sequences.
+   std::string make_string()
+   {
+      static const char* const pieces[] = { "a", "xyz", "\"", "\\", "\n", "\x01", "\x1f", "\x7f", "/", "\xc3\xa5", "\xe2\x82\xac" };
+      std::string str;
+      const unsigned length = next_random() % 4 == 0 ? next_random() % 300 : next_random() % 8;
+      for (unsigned i = 0; i < length; ++i)
+         str += pieces[next_random() % (sizeof(pieces) / sizeof(pieces[0]))];
+
+      return str;
+   }
+
+   double make_number()
+   {
+      switch (next_random() % 4)
+      {
+      case 0:
+         return static_cast<double>(next_random() % 100);
+      case 1:
+         return -1.2345678901234567e-300;
+      case 2:
+         return static_cast<double>(next_random()) / 7;
+      default:
+         return -static_cast<double>(next_random()) * 1e300;
+      }
+   }
+
+   adhd::json_value make_value(int depth)
+   {
+      const unsigned kind = depth > 0 ? next_random() % 9 : next_random() % 5;
+      switch (kind)
+      {
+      case 0:
+         return adhd::json_value();
+      case 1:
+         return adhd::json_value(adhd::json_bool(next_random() % 2 == 0));
+      case 2:
+         return adhd::json_value(make_number());
+      case 3:
+      case 4:
+         return adhd::json_value(make_string());
+      case 5:
+      {
+         adhd::json_value array = adhd::json_value(adhd::json_array());
+         for (unsigned i = next_random() % 6; i != 0; --i)
+            array.append_child() = make_value(depth - 1);
+
+         return array;
+      }
+      case 6:
+      {
+         std::vector<double> numbers;
+         for (unsigned i = next_random() % 6; i != 0; --i)
+            numbers.push_back(make_number());
+
+         return adhd::json_value(adhd::json_packed_array(numbers.data(), numbers.data() + numbers.size()));
+      }
+      case 7:
+      {
+         adhd::json_value object = adhd::json_value(adhd::json_object());
+         for (unsigned i = next_random() % 6; i != 0; --i)
+            object.put_child(make_string()) = make_value(depth - 1);
+
+         return object;
+      }
+      default:
+         return adhd::json_value(adhd::json_raw(next_random() % 2 == 0 ? "[1, \"two\" ,{}]" : "{ \"k\" : [null,true] }"));
+      }
+   }
+
+   /// Writes value in pieces of size characters, checking that every
+   /// piece but the last is full.
+   std::string serialize(const adhd::json_value& value, size_t size, int step)
+   {
+      adhd::json_serializer serializer(value);
+      std::vector<char> piece(size);
+      std::string output;
+      while (!serializer.done())
+      {
+         const size_t n = serializer.write(piece.data(), size);
+         output.append(piece.data(), n);
+         check(n == size || serializer.done(), "short piece before the end", step);
+         if (n == 0)
+            break;
+      }
+
+      return output;
+   }
+
+   void test_random()
+   {
+      static const size_t sizes[] = { 1, 2, 3, 7, 40, 41, 64, 4096 };
+      for (int step = 0; step < 2000; ++step)
+      {
+         const adhd::json_value value = make_value(4);
+         const std::string expected = value.to_string();
+         for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+            check(serialize(value, sizes[i], step) == expected, "same output as to_string", step);
+      }
+   }
+
+   void test_deep()
+   {
+      // The serializer keeps its place on the heap, whatever the depth.
+      const int depth = 100000;
+      adhd::json_value value;
+      adhd::json_value* leaf = &value;
+      for (int i = 0; i < depth; ++i)
+         leaf = &leaf->append_child();
+
+      *leaf = adhd::json_value(std::string(1000, '"'));
+      check(serialize(value, 13, -1) == value.to_string(), "deep output as to_string", -1);
+   }
+
+   void test_empty_piece()
+   {
+      adhd::json_value value = adhd::json_value(std::string("text"));
+      adhd::json_serializer serializer(value);
+      char piece[16];
+      check(serializer.write(piece, 0) == 0 && !serializer.done(), "nothing written to an empty piece", -1);
+      check(serializer.write(piece, sizeof(piece)) == 6 && std::string(piece, 6) == "\"text\"", "output after an empty piece", -1);
+      check(serializer.done(), "done after the output", -1);
+   }
+}
+
+int main()
+{
+   test_random();
+   test_deep();
+   test_empty_piece();
+
+   if (failures != 0)
+   {
+      std::printf("%d failures\n", failures);
+      return EXIT_FAILURE;
+   }
+
+   std::printf("passed\n");
+   return EXIT_SUCCESS;
+}
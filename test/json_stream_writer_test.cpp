@@ -0,0 +1,211 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Randomized check of json_stream_writer and json_pretty_stream_writer
+// against to_string and to_pretty_string, writing random documents call
+// by call, some parts as whole values. Build with json_value.cpp;
+// returns non-zero on failure.
+
+#include "../json_stream_writer.h"
+#include "../json_parser.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace
+{
+   int failures = 0;
+
+   void check(bool condition, const char* what, int step)
+   {
+      if (!condition)
+      {
+         if (++failures <= 10)
+            std::printf("FAILED: %s at step %d\n", what, step);
+      }
+   }
+
+   /// Deterministic so that failures reproduce.
+   unsigned next_random()
+   {
+      static unsigned state = 12345;
+      state = state * 1103515245u + 12345u;
+      return (state >> 8) & 0xffffff;
+   }
+
+   std::string make_string()
+   {
+      static const char* const pieces[] = { "a", "xyz", "\"", "\\", "\n", "\x01", "/", "\xc3\xa5" };
+      std::string str;
+      for (unsigned i = next_random() % 8; i != 0; --i)
+         str += pieces[next_random() % (sizeof(pieces) / sizeof(pieces[0]))];
+
+      return str;
+   }
+
+   adhd::json_value make_value(int depth)
+   {
+      switch (depth > 0 ? next_random() % 6 : next_random() % 4)
+      {
+      case 0:
+         return adhd::json_value();
+      case 1:
+         return adhd::json_value(adhd::json_bool(next_random() % 2 == 0));
+      case 2:
+         return adhd::json_value(next_random() % 2 == 0 ? static_cast<double>(next_random()) / 7 : -1e300);
+      case 3:
+         return adhd::json_value(make_string());
+      case 4:
+      {
+         adhd::json_value array = adhd::json_value(adhd::json_array());
+         for (unsigned i = next_random() % 5; i != 0; --i)
+            array.append_child() = make_value(depth - 1);
+
+         return array;
+      }
+      default:
+      {
+         adhd::json_value object = adhd::json_value(adhd::json_object());
+         for (unsigned i = next_random() % 5; i != 0; --i)
+            object.put_child(make_string()) = make_value(depth - 1);
+
+         return object;
+      }
+      }
+   }
+
+   /// Writes value through writer call by call, but for some arrays and
+   /// objects, written as whole values.
+   template <typename TStreamWriter>
+   void write(TStreamWriter& writer, const adhd::json_value& value)
+   {
+      if ((value.is_array() || value.is_object()) && next_random() % 8 == 0)
+      {
+         writer.value(value);
+      }
+      else if (value.is_array())
+      {
+         writer.begin_array();
+         for (adhd::json_value::const_element_iterator i = value.elements().begin(), e = value.elements().end(); i != e; ++i)
+            write(writer, *i);
+
+         writer.end_array();
+      }
+      else if (value.is_object())
+      {
+         writer.begin_object();
+         for (adhd::json_value::const_member_iterator i = value.members().begin(), e = value.members().end(); i != e; ++i)
+         {
+            writer.key((*i).first);
+            write(writer, (*i).second);
+         }
+
+         writer.end_object();
+      }
+      else if (value.is_string())
+      {
+         writer.value(value.get_string_ref());
+      }
+      else if (value.is_number())
+      {
+         writer.value(value.get_number());
+      }
+      else if (value.is_bool())
+      {
+         writer.value(adhd::json_bool(value.get_bool()));
+      }
+      else
+      {
+         writer.value(adhd::json_null());
+      }
+   }
+
+   void test_random()
+   {
+      for (int step = 0; step < 2000; ++step)
+      {
+         const adhd::json_value value = make_value(4);
+
+         adhd::json_buffer buffer;
+         adhd::json_stream_writer writer(buffer);
+         check(!writer.done(), "not done before writing", step);
+         write(writer, value);
+         check(writer.done(), "done after writing", step);
+         check(buffer.str() == value.to_string(), "same output as to_string", step);
+
+         adhd::json_buffer pretty_buffer;
+         adhd::json_pretty_stream_writer pretty_writer(pretty_buffer, 3);
+         write(pretty_writer, value);
+         check(pretty_writer.done(), "done after pretty writing", step);
+         check(pretty_buffer.str() == value.to_pretty_string(3), "same output as to_pretty_string", step);
+      }
+   }
+
+   void test_records()
+   {
+      // Records written as they are produced, through a small buffer
+      // flushing to a stream.
+      std::ostringstream os;
+      adhd::json_buffer buffer(os, 64);
+      adhd::json_stream_writer writer(buffer);
+      adhd::json_value expected = adhd::json_value(adhd::json_array());
+      writer.begin_array();
+      for (int i = 0; i < 10000; ++i)
+      {
+         writer.begin_object();
+         writer.key("id");
+         writer.value(static_cast<double>(i));
+         const std::string name = make_string();
+         writer.key("name");
+         writer.value(name);
+         writer.end_object();
+
+         adhd::json_value& record = expected.append_child();
+         record.put_child("id") = adhd::json_value(static_cast<double>(i));
+         record.put_child("name") = adhd::json_value(name);
+      }
+
+      writer.end_array();
+      buffer.flush();
+      check(writer.done(), "records done", -1);
+
+      adhd::json_value written;
+      adhd::json_parser().parse(os.str().c_str(), written);
+      check(written == expected, "records written", -1);
+   }
+
+   void test_deep()
+   {
+      const int depth = 100000;
+      adhd::json_buffer buffer;
+      adhd::json_stream_writer writer(buffer);
+      for (int i = 0; i < depth; ++i)
+         writer.begin_array();
+
+      for (int i = 0; i < depth; ++i)
+         writer.end_array();
+
+      check(writer.done(), "deep done", -1);
+      check(buffer.str() == std::string(depth, '[') + std::string(depth, ']'), "deep output", -1);
+   }
+}
+
+int main()
+{
+   test_random();
+   test_records();
+   test_deep();
+
+   if (failures != 0)
+   {
+      std::printf("%d failures\n", failures);
+      return EXIT_FAILURE;
+   }
+
+   std::printf("passed\n");
+   return EXIT_SUCCESS;
+}
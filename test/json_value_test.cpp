@@ -0,0 +1,255 @@
+// Copyright (C) 2012 Anders Dalle Henning Dalvander
+//
+// Use, modification and distribution are subject to the Boost Software
+// License, Version 1.0. (See accompanying file LICENSE_1_0.txt or copy at
+// http://www.boost.org/LICENSE_1_0.txt)
+
+// Checks of json_value sharing payloads between copies, where references
+// handed out by put_child and the like must not see, or change, copies,
+// nor leave stale hashes or output behind, and of the memory taken by
+// the output kept by to_cached_string. Build with json_value.cpp; returns
+// non-zero on failure.
+
+#include "../json_value.h"
+#include "../json_parser.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+namespace
+{
+   int failures = 0;
+
+   /// Bytes allocated by operator new and not yet deleted.
+   size_t allocated = 0;
+
+   /// Calls of operator new.
+   size_t allocations = 0;
+
+   /// Room ahead of each block allocated, keeping its size.
+   const size_t block_header = 16;
+
+   void check(bool condition, const char* what)
+   {
+      if (!condition)
+      {
+         ++failures;
+         std::printf("FAILED: %s\n", what);
+      }
+   }
+
+   void test_copy_after_put_child()
+   {
+      adhd::json_value a;
+      adhd::json_value& leaf = a.put_child("x").put_child("y");
+      adhd::json_value b = a;
+      leaf = adhd::json_value(2.0);
+      check(a.to_string() == "{\"x\":{\"y\":2}}", "write through put_child reference");
+      check(b.to_string() == "{\"x\":{\"y\":null}}", "copy untouched by put_child reference");
+
+      adhd::json_value c;
+      adhd::json_value& element = c.append_child();
+      adhd::json_value d(c, c.get_allocator());
+      element = adhd::json_value(3.0);
+      check(d.to_string() == "[null]", "copy with allocator untouched by append_child reference");
+   }
+
+   void test_copy_after_ranges()
+   {
+      adhd::json_value a;
+      a.append_child() = adhd::json_value(1.0);
+      boost::iterator_range<adhd::json_value::element_iterator> elements = a.elements();
+      adhd::json_value b = a;
+      *elements.begin() = adhd::json_value(5.0);
+      check(b.to_string() == "[1]", "copy untouched by element range");
+
+      adhd::json_value c;
+      c.put_child("p") = adhd::json_value(1.0);
+      boost::iterator_range<adhd::json_value::member_iterator> members = c.members();
+      adhd::json_value d = c;
+      (*members.begin()).second = adhd::json_value(5.0);
+      check(d.to_string() == "{\"p\":1}", "copy untouched by member range");
+   }
+
+   void test_copy_deep()
+   {
+      // Every level has handed out a reference, so every level is copied,
+      // which must not take stack for each level.
+      const int depth = 200000;
+      adhd::json_value a;
+      adhd::json_value* leaf = &a;
+      for (int i = 0; i < depth; ++i)
+         leaf = &leaf->put_child("x");
+
+      adhd::json_value b = a;
+      *leaf = adhd::json_value(1.0);
+      check(a != b, "deep copy untouched by put_child reference");
+
+      adhd::json_value* other = &b;
+      for (int i = 0; i < depth; ++i)
+         other = &other->put_child("x");
+
+      *other = adhd::json_value(1.0);
+      check(a == b, "deep copy written alike");
+      check(a.hash() == b.hash(), "deep copy hashed alike");
+   }
+
+   void test_hash_after_put_child()
+   {
+      adhd::json_value a;
+      adhd::json_value& leaf = a.put_child("x").put_child("y");
+      leaf = adhd::json_value(1.0);
+      adhd::json_value b;
+      b.put_child("x").put_child("y") = adhd::json_value(2.0);
+      a.hash();
+      b.hash();
+      leaf = adhd::json_value(2.0);
+      check(a.hash() == b.hash(), "hash after write through put_child reference");
+      check(a == b, "equal after write through put_child reference");
+
+      adhd::json_value c;
+      adhd::json_value& element = c.append_child();
+      element = adhd::json_value(1.0);
+      c.hash();
+      element = adhd::json_value(2.0);
+      c.pack();
+      adhd::json_value d;
+      d.append_child() = adhd::json_value(2.0);
+      check(c.hash() == d.hash(), "hash of packed array after write through append_child reference");
+   }
+
+   void test_hash_parsed_cached()
+   {
+      // Deep enough for hash to take memory for its stack, unless it
+      // finds the hash of the root cached.
+      const std::string text = std::string(100, '[') + "{\"x\":1}" + std::string(100, ']');
+      adhd::json_value value;
+      adhd::json_parser().parse(text.c_str(), value);
+
+      const size_t before = allocations;
+      const size_t hash = value.hash();
+      check(allocations != before, "first hash of parsed document walks it");
+
+      const size_t walked = allocations;
+      const adhd::json_value copy = value;
+      check(value.hash() == hash && copy.hash() == hash, "parsed document hashed alike");
+      check(allocations == walked, "hash of parsed document cached");
+   }
+
+   void test_cached_string_after_put_child()
+   {
+      adhd::json_value a;
+      adhd::json_value& leaf = a.put_child("some rather long member name").put_child("y");
+      a.to_cached_string();
+      leaf = adhd::json_value(2.0);
+      check(a.to_cached_string() == a.to_string(), "cached string after write through put_child reference");
+   }
+
+   void test_cached_string_deep()
+   {
+      const int depth = 20000;
+      const std::string text = std::string(depth, '[') + std::string(depth, ']');
+      adhd::json_value value;
+      adhd::json_parser().parse(text.c_str(), value);
+
+      const size_t before = allocated;
+      const std::string output = value.to_cached_string();
+      const size_t kept = allocated - before - output.capacity();
+      check(output == text, "deep cached string");
+      check(kept <= 4 * output.size(), "output kept linear in output size");
+   }
+
+   void test_cached_string_parsed()
+   {
+      std::string text = "[";
+      for (int i = 0; i < 1000; ++i)
+         text += i == 0 ? "{\"id\":1,\"name\":\"some name\",\"tags\":[\"a\",\"b\"]}" : ",{\"id\":1,\"name\":\"some name\",\"tags\":[\"a\",\"b\"]}";
+      text += "]";
+
+      adhd::json_value value;
+      adhd::json_parser().parse(text.c_str(), value);
+      const std::string output = value.to_cached_string();
+      check(output == text, "cached string of parsed document");
+
+      // Unchanged, the output kept for the document is copied as it is
+      // and nothing more is kept: the only memory left taken is that of
+      // the string returned, with its terminating null.
+      const size_t before = allocated;
+      const std::string again = value.to_cached_string();
+      check(again == text, "cached string of parsed document again");
+      check(allocated - before == again.capacity() + 1, "output of parsed document kept");
+   }
+
+   void test_copy_parsed_shares()
+   {
+      adhd::json_value a;
+      adhd::json_parser().parse("[{\"x\":[1,\"s\"],\"y\":{\"z\":null}},[true]]", a);
+      adhd::json_value b = a;
+      check(&a.get_child(0) == &b.get_child(0), "copy of parsed document shares root");
+      check(&a.get_child(0).get_child("y") == &b.get_child(0).get_child("y"), "copy of parsed document shares members");
+   }
+
+   void test_copy_shares()
+   {
+      adhd::json_value a;
+      a.put_child("x") = adhd::json_value(1.0);
+      adhd::json_value b = a;
+      adhd::json_value c = b;
+      check(&a.get_child("x") != &b.get_child("x"), "copy of value references were taken from");
+      check(&b.get_child("x") == &c.get_child("x"), "copies of copy share");
+   }
+}
+
+void* operator new(size_t size)
+{
+   // The size is stored ahead of the block, for operator delete.
+   void* p = std::malloc(size + block_header);
+   if (!p)
+      throw std::bad_alloc();
+
+   *static_cast<size_t*>(p) = size;
+   allocated += size;
+   ++allocations;
+   return static_cast<char*>(p) + block_header;
+}
+
+void operator delete(void* p) BOOST_NOEXCEPT
+{
+   if (!p)
+      return;
+
+   char* block = static_cast<char*>(p) - block_header;
+   allocated -= *reinterpret_cast<size_t*>(block);
+   std::free(block);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* p, size_t /*size*/) BOOST_NOEXCEPT
+{
+   operator delete(p);
+}
+#endif
+
+int main()
+{
+   test_copy_after_put_child();
+   test_copy_after_ranges();
+   test_copy_deep();
+   test_hash_after_put_child();
+   test_hash_parsed_cached();
+   test_cached_string_after_put_child();
+   test_cached_string_deep();
+   test_cached_string_parsed();
+   test_copy_parsed_shares();
+   test_copy_shares();
+
+   if (failures != 0)
+   {
+      std::printf("%d failures\n", failures);
+      return EXIT_FAILURE;
+   }
+
+   std::printf("passed\n");
+   return EXIT_SUCCESS;
+}